@@ -12,10 +12,11 @@ endforeach()
 
 find_path(LIBEVENT_INCLUDE_DIR event.h PATHS ${LibEvent_INCLUDE_PATHS})
 find_library(LIBEVENT_LIB NAMES event PATHS ${LibEvent_LIB_PATHS})
+find_library(LIBEVENT_PTHREADS_LIB NAMES event_pthreads PATHS ${LibEvent_LIB_PATHS})
 
-if (LIBEVENT_LIB AND LIBEVENT_INCLUDE_DIR)
+if (LIBEVENT_LIB AND LIBEVENT_PTHREADS_LIB AND LIBEVENT_INCLUDE_DIR)
   set(LibEvent_FOUND TRUE)
-  set(LIBEVENT_LIB ${LIBEVENT_LIB})
+  set(LIBEVENT_LIB ${LIBEVENT_LIB} ${LIBEVENT_PTHREADS_LIB})
 else ()
   set(LibEvent_FOUND FALSE)
 endif ()
@@ -33,5 +34,6 @@ endif ()
 
 mark_as_advanced(
     LIBEVENT_LIB
+    LIBEVENT_PTHREADS_LIB
     LIBEVENT_INCLUDE_DIR
   )
@@ -0,0 +1,26 @@
+# FindLiburing.cmake - Try to find liburing
+# Once done this will define
+#
+#  LIBURING_FOUND - System has liburing
+#  LIBURING_INCLUDE_DIR - The liburing include directory
+#  LIBURING_LIBRARIES - The libraries needed to use liburing
+
+FIND_PATH(LIBURING_INCLUDE_DIR NAMES liburing.h
+   HINTS
+   /usr
+   /usr/local
+   /usr/local/include
+   /opt
+   )
+
+FIND_LIBRARY(LIBURING_LIBRARIES NAMES uring
+   HINTS
+   /usr
+   /usr/local
+   /opt
+   )
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(Liburing DEFAULT_MSG LIBURING_LIBRARIES LIBURING_INCLUDE_DIR)
+
+MARK_AS_ADVANCED(LIBURING_INCLUDE_DIR LIBURING_LIBRARIES)
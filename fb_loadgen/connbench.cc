@@ -0,0 +1,250 @@
+#include <glog/logging.h>
+
+#include "api/apidef_generated.h"
+#include "utils/variables.h"
+
+#include <event2/event.h>
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+/*
+ * Connection scaling benchmark for fbgw: opens <connections> sessions with
+ * at most FB_CONNBENCH_INFLIGHT connects outstanding, sends one order on
+ * each, holds them for <seconds> and reports how many the gateway kept.
+ *
+ * One source address only has ~28k ephemeral ports towards a given port,
+ * so against loopback FB_CONNBENCH_SOURCES spreads connections over
+ * 127.0.0.1, 127.0.0.2, ...
+ */
+
+typedef std::chrono::steady_clock clock_type;
+
+struct pending_connect {
+  int fd;
+  clock_type::time_point started;
+  struct event *ev;
+};
+
+static struct sockaddr_in target;
+static struct event_base *base;
+
+static size_t wanted = 0, started = 0, finished = 0, failed = 0;
+static size_t inflight_limit = 0, sources = 1;
+static std::vector<int> established;
+static std::vector<uint64_t> connect_latencies;
+
+static void connectcb(evutil_socket_t fd, short events, void *arg);
+
+// --
+static void start_connects() {
+  while (started < wanted && started - finished < inflight_limit) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+      LOG(ERROR) << "socket: " << strerror(errno);
+      event_base_loopexit(base, nullptr);
+      return;
+    }
+
+    if (sources > 1) {
+      struct sockaddr_in source;
+      memset(&source, 0, sizeof(source));
+      source.sin_family = AF_INET;
+      source.sin_addr.s_addr = htonl(0x7f000001 + started % sources);
+
+      if (bind(fd, reinterpret_cast<struct sockaddr *>(&source), sizeof(source)) < 0) {
+        LOG(ERROR) << "bind: " << strerror(errno);
+      }
+    }
+
+    started++;
+
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&target), sizeof(target)) < 0 && errno != EINPROGRESS) {
+      LOG_EVERY_N(ERROR, 1000) << "connect: " << strerror(errno);
+      close(fd);
+      finished++;
+      failed++;
+      continue;
+    }
+
+    pending_connect *p = new pending_connect;
+    p->fd = fd;
+    p->started = clock_type::now();
+    p->ev = event_new(base, fd, EV_WRITE, connectcb, p);
+    event_add(p->ev, nullptr);
+  }
+}
+
+// --
+static void connectcb(evutil_socket_t fd, short events, void *arg) {
+  pending_connect *p = static_cast<pending_connect *>(arg);
+
+  int error = 0;
+  socklen_t len = sizeof(error);
+  getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+
+  if (error == 0) {
+    connect_latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - p->started).count());
+    established.push_back(fd);
+  }
+  else {
+    LOG_EVERY_N(ERROR, 1000) << "connect: " << strerror(error);
+    close(fd);
+    failed++;
+  }
+
+  event_free(p->ev);
+  delete p;
+  finished++;
+
+  if (finished == wanted) {
+    event_base_loopexit(base, nullptr);
+  }
+  else {
+    start_connects();
+  }
+}
+
+// --
+static size_t send_orders() {
+  flatbuffers::FlatBufferBuilder builder(200);
+  size_t sent = 0;
+
+  for (size_t i = 0; i < established.size(); ++i) {
+    builder.Clear();
+
+    auto ins = builder.CreateString("ERICB");
+
+    api::LimitOrderBuilder order_builder(builder);
+    order_builder.add_local_id(i + 1);
+    order_builder.add_price(23000);
+    order_builder.add_quantity(80);
+    order_builder.add_ins_id(ins);
+    order_builder.add_side(api::SideType_Buy);
+    auto order = order_builder.Finish();
+
+    auto root = api::CreateMessage(builder, api::MessageType_LimitOrder, order.Union());
+    builder.Finish(root);
+
+    std::vector<char> frame(sizeof(unsigned short) + builder.GetSize());
+    unsigned short data_length = builder.GetSize();
+    memcpy(frame.data(), &data_length, sizeof(data_length));
+    memcpy(frame.data() + sizeof(data_length), builder.GetBufferPointer(), builder.GetSize());
+
+    if (write(established[i], frame.data(), frame.size()) == static_cast<ssize_t>(frame.size())) {
+      sent++;
+    }
+  }
+
+  return sent;
+}
+
+// --
+static size_t count_closed() {
+  size_t closed = 0;
+  char c;
+
+  for (int fd : established) {
+    ssize_t n = recv(fd, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      closed++;
+    }
+  }
+
+  return closed;
+}
+
+// --
+static uint64_t percentile(double p) {
+  if (connect_latencies.empty()) {
+    return 0;
+  }
+
+  return connect_latencies[std::min(connect_latencies.size() - 1, static_cast<size_t>(p * connect_latencies.size()))];
+}
+
+int main(int argc, const char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  if (argc != 5) {
+    std::cerr << "Usage: fb_connbench <address> <port> <connections> <seconds>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(atoi(argv[2]));
+
+  if (!inet_aton(argv[1], &target.sin_addr)) {
+    LOG(ERROR) << "Failed to parse host address";
+    return EXIT_FAILURE;
+  }
+
+  wanted = strtoul(argv[3], nullptr, 10);
+  int seconds = atoi(argv[4]);
+  inflight_limit = std::max<size_t>(read_variable<size_t>("FB_CONNBENCH_INFLIGHT", 1000), 1);
+  sources = std::max<size_t>(read_variable<size_t>("FB_CONNBENCH_SOURCES", 1), 1);
+
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  if (limit.rlim_cur < wanted + 16) {
+    LOG(WARNING) << "fd limit " << limit.rlim_cur << " is below the connection count";
+  }
+
+  base = event_base_new();
+  if (!base) {
+    LOG(ERROR) << "Failed to open event base";
+    return EXIT_FAILURE;
+  }
+
+  established.reserve(wanted);
+  connect_latencies.reserve(wanted);
+
+  auto start_time = clock_type::now();
+  start_connects();
+
+  if (finished < wanted) {
+    event_base_dispatch(base);
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - start_time).count();
+
+  size_t sent = send_orders();
+  sleep(seconds);
+  size_t closed = count_closed();
+
+  std::sort(begin(connect_latencies), end(connect_latencies));
+
+  std::cout << std::setw(30) << "Connections established: " << established.size() << std::endl;
+  std::cout << std::setw(30) << "Connections failed: " << failed << std::endl;
+  std::cout << std::setw(30) << "Time to establish (ms): " << elapsed << std::endl;
+  std::cout << std::setw(30) << "Connects per second: " << (elapsed ? established.size() * 1000 / elapsed : 0) << std::endl;
+  std::cout << std::setw(30) << "Connect p50/p99/max (us): "
+            << percentile(0.5) << "/" << percentile(0.99) << "/" << percentile(1.0) << std::endl;
+  std::cout << std::setw(30) << "Orders sent: " << sent << std::endl;
+  std::cout << std::setw(30) << "Closed by gateway: " << closed << std::endl;
+
+  for (int fd : established) {
+    close(fd);
+  }
+
+  event_base_free(base);
+  return EXIT_SUCCESS;
+}
@@ -17,6 +17,7 @@
 
 static int64_t total_bytes_written = 0;
 static int64_t total_messages_written = 0;
+static int64_t total_reports_read = 0;
 
 static void timeoutcb(evutil_socket_t fd, short what, void *arg) {
   struct event_base *base = reinterpret_cast<struct event_base *>(arg);
@@ -51,6 +52,18 @@ static void writecb(struct bufferevent *bev, void *ctx) {
   total_bytes_written += evbuffer_get_length(bufferevent_get_output(bev));
 }
 
+// Execution reports coming back, counted and thrown away
+static void readcb(struct bufferevent *bev, void *ctx) {
+  struct evbuffer *input = bufferevent_get_input(bev);
+  unsigned short data_length;
+
+  while (evbuffer_copyout(input, &data_length, sizeof(data_length)) == sizeof(data_length) &&
+         evbuffer_get_length(input) >= sizeof(data_length) + data_length) {
+    evbuffer_drain(input, sizeof(data_length) + data_length);
+    ++total_reports_read;
+  }
+}
+
 static void eventcb(struct bufferevent *bev, short events, void *ptr) {
   if (events & BEV_EVENT_CONNECTED) {
     int one = 1;
@@ -104,7 +117,7 @@ int main(int argc, const char **argv) {
   }
 
   struct bufferevent *bev = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
-  bufferevent_setcb(bev, nullptr, writecb, eventcb, NULL);
+  bufferevent_setcb(bev, readcb, writecb, eventcb, NULL);
   bufferevent_enable(bev, EV_READ|EV_WRITE);
 
   if (bufferevent_socket_connect(bev, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
@@ -122,6 +135,7 @@ int main(int argc, const char **argv) {
 
   std::cout << std::setw(30) << "Total bytes written: " << total_bytes_written << std::endl;
   std::cout << std::setw(30) << "Total messages written: " << total_messages_written << std::endl;
+  std::cout << std::setw(30) << "Total reports read: " << total_reports_read << std::endl;
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,95 @@
+#include <glog/logging.h>
+
+#include "api/apidef_generated.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+/*
+ * Cost of the FlatBuffers verifier per order, next to just reading the
+ * fields, with the limits fbgw verifies under (FBGW_VERIFY_MAX_DEPTH and
+ * FBGW_VERIFY_MAX_TABLES defaults).
+ */
+
+typedef std::chrono::steady_clock clock_type;
+
+// Keeps the optimizer from dropping the loops
+static volatile uint64_t sink;
+
+// --
+static std::vector<uint8_t> build_order() {
+  flatbuffers::FlatBufferBuilder builder(200);
+
+  auto ins = builder.CreateString("ERICB");
+
+  api::LimitOrderBuilder order_builder(builder);
+  order_builder.add_local_id(1);
+  order_builder.add_price(23000);
+  order_builder.add_quantity(80);
+  order_builder.add_ins_id(ins);
+  order_builder.add_side(api::SideType_Buy);
+  auto order = order_builder.Finish();
+
+  auto root = api::CreateMessage(builder, api::MessageType_LimitOrder, order.Union());
+  builder.Finish(root);
+
+  return std::vector<uint8_t>(builder.GetBufferPointer(), builder.GetBufferPointer() + builder.GetSize());
+}
+
+// --
+static uint64_t read_fields(const uint8_t *data, size_t size) {
+  auto order = static_cast<const api::LimitOrder *>(api::GetMessage(data)->Body());
+  return order->local_id() + order->price() + order->quantity() + order->side() + order->ins_id()->size();
+}
+
+// --
+static uint64_t verify_and_read(const uint8_t *data, size_t size) {
+  flatbuffers::Verifier verifier(data, size, 8, 64, false);
+  if (!api::VerifyMessageBuffer(verifier)) {
+    LOG(ERROR) << "Order failed verification";
+    std::abort();
+  }
+
+  return read_fields(data, size);
+}
+
+// --
+template <typename F>
+static double ns_per_message(const std::vector<uint8_t> &message, size_t iterations, F fn) {
+  uint64_t sum = 0;
+  auto start = clock_type::now();
+
+  for (size_t i = 0; i < iterations; ++i) {
+    sum += fn(message.data(), message.size());
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+  sink = sum;
+
+  return static_cast<double>(elapsed) / iterations;
+}
+
+int main(int argc, const char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+  auto message = build_order();
+
+  // Warm up
+  ns_per_message(message, iterations / 10, verify_and_read);
+
+  double read = ns_per_message(message, iterations, read_fields);
+  double verified = ns_per_message(message, iterations, verify_and_read);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(30) << "Message size (bytes): " << message.size() << std::endl;
+  std::cout << std::setw(30) << "Read fields (ns/msg): " << read << std::endl;
+  std::cout << std::setw(30) << "Verify + read (ns/msg): " << verified << std::endl;
+  std::cout << std::setw(30) << "Verifier cost (ns/msg): " << verified - read << std::endl;
+
+  return EXIT_SUCCESS;
+}
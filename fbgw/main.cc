@@ -7,7 +7,9 @@
 #include "matcher/matcher.h"
 #include "messaging/messaging_service.h"
 #include "messaging/loopback_service.h"
+#include "messaging/shm_service.h"
 #include "utils/thread.h"
+#include "utils/variables.h"
 
 #include "server.h"
 
@@ -17,7 +19,13 @@ int main(int argc, char **argv) {
 
   LOG(INFO) << "Starting FlatBuffer gw...";
 
-  messaging_init();
+  if (read_variable<bool>("MSG_SHM", false)) {
+    shm_messaging_init();
+  }
+  else {
+    messaging_init();
+  }
+
   matcher_init();
 
   if (argc > 1 && strcmp(argv[1], "standby") == 0) {
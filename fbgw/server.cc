@@ -1,17 +1,24 @@
 #include "server.h"
 #include "api/apidef_generated.h"
 #include "framework/services.h"
+#include "utils/memory.h"
+#include "utils/thread.h"
+#include "utils/timing.h"
+#include "utils/token_bucket.h"
+#include "utils/variables.h"
 
 #include <glog/logging.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 
 #include <event2/event.h>
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
+#include <event2/thread.h>
 
 #include <assert.h>
 #include <unistd.h>
@@ -20,45 +27,449 @@
 #include <stdio.h>
 #include <errno.h>
 #include <iostream>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 static void do_read(evutil_socket_t fd, short events, void *arg);
 static void do_write(evutil_socket_t fd, short events, void *arg);
 
+typedef uint16_t frame_length_t;
+
+/*
+ * One gateway event loop on its own core. Each reactor has its own
+ * SO_REUSEPORT listener, and the kernel spreads incoming connections over
+ * them by address hash; sessions stay on the reactor that accepted them.
+ */
+struct reactor;
+
+// Rate limit shared by all sessions from one client address; there is no
+// login, so the address is the account
+struct account {
+  account(double rate, double burst) : bucket(rate, burst) {}
+
+  std::mutex m;
+  token_bucket bucket;
+};
+
+// A client connection. Reports find it by id, so one arriving after the
+// session is gone is simply dropped.
+struct session {
+  reactor *r;
+  uint64_t id;
+  struct bufferevent *bev;
+
+  // Throttling, both optional; the timer is created on first delay
+  std::unique_ptr<token_bucket> bucket;
+  std::shared_ptr<account> acct;
+  struct event *throttle_event = nullptr;
+};
+
+struct reactor {
+  size_t index;
+  struct event_base *base = nullptr;
+  evutil_socket_t listener = -1;
+  struct event *listener_event = nullptr;
+
+  // Held open so a full fd table can still accept-and-close (EMFILE)
+  int spare_fd = -1;
+
+  // Sessions we stopped reading from because messaging ran out of tx credit
+  struct event *resume_event = nullptr;
+  std::set<session *> paused_sessions;
+
+  uint64_t next_session_id = 0;
+  std::unordered_map<uint64_t, session *> sessions_by_id;
+
+  // Execution reports handed over by the messaging thread, as
+  // [session id][frame length][message] records
+  std::mutex outbox_m;
+  std::vector<char> outbox;
+  std::vector<char> outbox_flushing;
+  struct event *outbox_event = nullptr;
+
+  std::atomic<size_t> sessions{0};
+  std::atomic<uint64_t> throttle_rejected{0};
+  std::atomic<uint64_t> throttle_delayed{0};
+  distribution frames_per_read{"fbgw_frames_per_read"};
+  distribution reports_per_wakeup{"fbgw_reports_per_wakeup"};
+};
+
+// Client local_id to the session that sent it, for routing reports back
+typedef struct route {
+  reactor *r;
+  uint64_t session_id;
+} route_t;
+
 static messaging_t *messaging;
+static size_t max_frame_size;
+static size_t verify_max_depth, verify_max_tables;
+static int accept_batch;
+static messaging_credit_callback_t credit_cb;
+static messaging_callback_t report_cb;
+static std::vector<std::unique_ptr<reactor>> reactors;
+
+static std::mutex routes_m;
+static std::unordered_map<uint64_t, route_t> routes;
+
+// FBGW_SESSION_RATE/FBGW_ACCOUNT_RATE in messages per second, 0 is unlimited.
+// Over the limit, FBGW_THROTTLE=delay stops reading from the session until
+// a token is due, reject answers each order with ERR_THROTTLED.
+static double session_rate, session_burst;
+static double account_rate, account_burst;
+static bool throttle_reject;
+
+static std::mutex accounts_m;
+static std::unordered_map<uint32_t, std::shared_ptr<account>> accounts;
+
+static void close_session(session *s) {
+  reactor *r = s->r;
+
+  r->paused_sessions.erase(s);
+  r->sessions_by_id.erase(s->id);
+  r->sessions--;
+
+  if (s->throttle_event) {
+    event_free(s->throttle_event);
+  }
+
+  bufferevent_free(s->bev);
+  delete s;
+}
+
+// --
+// Takes a token from the session and the account. Zero means go ahead,
+// otherwise it's how long until the frame would be let through.
+static token_bucket::clock::duration throttle(session *s, token_bucket::clock::time_point now) {
+  if (s->bucket && !s->bucket->take(now)) {
+    return s->bucket->wait_time(now);
+  }
+
+  if (s->acct) {
+    std::lock_guard<std::mutex> lock(s->acct->m);
+
+    if (!s->acct->bucket.take(now)) {
+      if (s->bucket) {
+        s->bucket->give_back();
+      }
+
+      return s->acct->bucket.wait_time(now);
+    }
+  }
+
+  return token_bucket::clock::duration::zero();
+}
+
+// --
+// For a frame that was let through but then couldn't be sent
+static void unthrottle(session *s) {
+  if (s->bucket) {
+    s->bucket->give_back();
+  }
+
+  if (s->acct) {
+    std::lock_guard<std::mutex> lock(s->acct->m);
+    s->acct->bucket.give_back();
+  }
+}
+
+// --
+static void reject_throttled(session *s, const api::Message *msg) {
+  if (msg->Body_type() != api::MessageType_LimitOrder) {
+    return;
+  }
+
+  auto order = static_cast<const api::LimitOrder *>(msg->Body());
+
+  flatbuffers::FlatBufferBuilder builder(200);
+  auto ins = builder.CreateString(order->ins_id() ? order->ins_id()->c_str() : "");
+
+  api::ExecutionReportBuilder report_builder(builder);
+  report_builder.add_ins_id(ins);
+  report_builder.add_local_id(order->local_id());
+  report_builder.add_exec_type(api::ExecType_Rejected);
+  report_builder.add_price(order->price());
+  report_builder.add_reason(ERR_THROTTLED);
+  auto report = report_builder.Finish();
+
+  auto root = api::CreateMessage(builder, api::MessageType_ExecutionReport, report.Union());
+  builder.Finish(root);
+
+  frame_length_t length = builder.GetSize();
+  struct evbuffer *output = bufferevent_get_output(s->bev);
+  evbuffer_add(output, &length, sizeof(length));
+  evbuffer_add(output, builder.GetBufferPointer(), length);
+}
+
+static void readcb(struct bufferevent *bev, void *ctx);
+
+// --
+static void throttlecb(evutil_socket_t fd, short events, void *arg) {
+  session *s = static_cast<session *>(arg);
+
+  bufferevent_enable(s->bev, EV_READ);
+  readcb(s->bev, s);
+}
+
+// --
+static void add_route(uint64_t local_id, session *s) {
+  std::lock_guard<std::mutex> lock(routes_m);
 
+  auto result = routes.insert({local_id, {s->r, s->id}});
+  if (!result.second && (result.first->second.r != s->r || result.first->second.session_id != s->id)) {
+    LOG_EVERY_N(WARNING, 1000) << "local_id " << local_id << " reused by another session, reports follow the latest";
+    result.first->second = {s->r, s->id};
+  }
+}
+
+// --
+// The gateway is where untrusted bytes enter the bus, so every frame is run
+// through the verifier here, once. Cost is linear in the frame, which is
+// already capped at FBGW_MAX_FRAME_SIZE; depth and table count are capped
+// too. Only client request types are let through, a client must not be able
+// to inject reports for other sessions.
+static bool verify_frame(const char *data, size_t size) {
+  // Frames sit at any offset in evbuffer memory, nothing downstream needs them aligned
+  flatbuffers::Verifier verifier(reinterpret_cast<const uint8_t *>(data), size, verify_max_depth, verify_max_tables, false);
+
+  if (!api::VerifyMessageBuffer(verifier)) {
+    return false;
+  }
+
+  switch (api::GetMessage(data)->Body_type()) {
+  case api::MessageType_LimitOrder:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+// Frames are a host order length prefix followed by a FlatBuffer message.
+// Contiguous frames go to messaging straight out of evbuffer memory, only a
+// frame spanning chunks is pulled up. Everything handled is drained at once.
 static void readcb(struct bufferevent *bev, void *ctx) {
-  struct evbuffer *input, *output;
-  char *line;
-  size_t n;
-  int i;
-  input = bufferevent_get_input(bev);
-  output = bufferevent_get_output(bev);
+  session *s = static_cast<session *>(ctx);
+  reactor *r = s->r;
+  struct evbuffer *input = bufferevent_get_input(bev);
+  size_t available = evbuffer_get_length(input);
+  size_t consumed = 0;
+  uint64_t frames = 0;
+  auto now = token_bucket::clock::now();
 
+  while (available - consumed >= sizeof(frame_length_t)) {
+    struct evbuffer_ptr pos;
+    evbuffer_ptr_set(input, &pos, consumed, EVBUFFER_PTR_SET);
 
-  while (1) {
-    evbuffer_iovec vecs[1];
-    if (!evbuffer_peek(input, sizeof(unsigned short), nullptr, vecs, 1)) {
+    // The prefix itself may straddle two chunks
+    frame_length_t data_length;
+    evbuffer_copyout_from(input, &pos, &data_length, sizeof(data_length));
+
+    if (data_length == 0 || data_length > max_frame_size) {
+      LOG(WARNING) << "Closing session sending a frame of " << data_length << " bytes, limit is " << max_frame_size;
+      close_session(s);
       return;
     }
 
-    if (vecs[0].iov_len < sizeof(unsigned short)) {
-      return;
+    size_t frame_size = sizeof(frame_length_t) + data_length;
+    if (available - consumed < frame_size) {
+      break;
     }
 
-    unsigned short data_length = *reinterpret_cast<unsigned short *>(vecs[0].iov_base);
+    evbuffer_ptr_set(input, &pos, sizeof(frame_length_t), EVBUFFER_PTR_ADD);
 
-    if (evbuffer_get_length(input) >= data_length + sizeof(unsigned short)) {
-      // NOTE: a copy is being made here, either skip this copy or the one in messaging
-      char buf[1024];
-      int n = evbuffer_remove(input, buf, data_length + sizeof(unsigned short));
-      messaging->send_message(buf + 2, n - 2);
-      // TODO: verify data
+    struct evbuffer_iovec vec;
+    const char *data;
 
+    if (evbuffer_peek(input, data_length, &pos, &vec, 1) == 1) {
+      data = static_cast<const char *>(vec.iov_base);
     }
     else {
+      // Pullup works from the front, so let go of what's been handled first
+      evbuffer_drain(input, consumed);
+      available -= consumed;
+      consumed = 0;
+
+      data = reinterpret_cast<const char *>(evbuffer_pullup(input, frame_size)) + sizeof(frame_length_t);
+    }
+
+    if (!verify_frame(data, data_length)) {
+      LOG(WARNING) << "Closing session sending a malformed frame of " << data_length << " bytes";
+      close_session(s);
+      return;
+    }
+
+    const api::Message *msg = api::GetMessage(data);
+
+    auto wait = throttle(s, now);
+    if (wait != token_bucket::clock::duration::zero()) {
+      if (throttle_reject) {
+        r->throttle_rejected++;
+        reject_throttled(s, msg);
+
+        consumed += frame_size;
+        continue;
+      }
+
+      // Read side backpressure: leave it in the socket until a token is due
+      r->throttle_delayed++;
+      bufferevent_disable(bev, EV_READ);
+
+      if (!s->throttle_event) {
+        s->throttle_event = evtimer_new(r->base, throttlecb, s);
+      }
+
+      auto usec = std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+      struct timeval tv = {static_cast<time_t>(usec / 1000000), static_cast<suseconds_t>(usec % 1000000)};
+      evtimer_add(s->throttle_event, &tv);
+      break;
+    }
+
+    // Known before the order leaves, so no report can beat the route
+    if (msg->Body_type() == api::MessageType_LimitOrder) {
+      add_route(static_cast<const api::LimitOrder *>(msg->Body())->local_id(), s);
+    }
+
+    status_t status = messaging->send_message(data, data_length);
+
+    if (status == ERR_TXFULL) {
+      // Leave the frame buffered and stop reading until messaging has room
+      unthrottle(s);
+      bufferevent_disable(bev, EV_READ);
+      r->paused_sessions.insert(s);
+      break;
+    }
+
+    if (status == ERR_MSGSIZE) {
+      LOG(WARNING) << "Closing session sending a frame of " << data_length << " bytes, too large for messaging";
+      close_session(s);
       return;
     }
+
+    consumed += frame_size;
+    frames++;
+  }
+
+  evbuffer_drain(input, consumed);
+
+  if (frames > 0) {
+    r->frames_per_read.collect(frames);
+  }
+}
+
+// Runs on the messaging thread
+static void credit_available(void *opaque) {
+  for (auto &r : reactors) {
+    event_active(r->resume_event, EV_TIMEOUT, 0);
+  }
+}
+
+static void resumecb(evutil_socket_t fd, short events, void *arg) {
+  reactor *r = static_cast<reactor *>(arg);
+
+  std::set<session *> sessions;
+  sessions.swap(r->paused_sessions);
+
+  for (auto s : sessions) {
+    bufferevent_enable(s->bev, EV_READ);
+    readcb(s->bev, s);
+  }
+}
+
+// --
+// Runs on the messaging thread. Reports for local_ids we never saw belong
+// to another gateway.
+static status_t received_report(const void *data, size_t size) {
+  const api::Message *msg = api::GetMessage(data);
+  if (msg->Body_type() != api::MessageType_ExecutionReport) {
+    return SUC_OK;
+  }
+
+  auto report = static_cast<const api::ExecutionReport *>(msg->Body());
+  route_t route;
+
+  {
+    std::lock_guard<std::mutex> lock(routes_m);
+
+    auto iter = routes.find(report->local_id());
+    if (iter == end(routes)) {
+      return SUC_OK;
+    }
+
+    route = iter->second;
+
+    if (report->exec_type() == api::ExecType_Rejected || report->leaves_quantity() == 0) {
+      routes.erase(iter);
+    }
+  }
+
+  reactor *r = route.r;
+  frame_length_t length = size;
+  bool wake;
+
+  {
+    std::lock_guard<std::mutex> lock(r->outbox_m);
+    wake = r->outbox.empty();
+
+    const char *session_id = reinterpret_cast<const char *>(&route.session_id);
+    const char *frame_length = reinterpret_cast<const char *>(&length);
+    const char *message = static_cast<const char *>(data);
+
+    r->outbox.insert(end(r->outbox), session_id, session_id + sizeof(route.session_id));
+    r->outbox.insert(end(r->outbox), frame_length, frame_length + sizeof(length));
+    r->outbox.insert(end(r->outbox), message, message + size);
+  }
+
+  if (wake) {
+    event_active(r->outbox_event, EV_TIMEOUT, 0);
+  }
+
+  return SUC_OK;
+}
+
+// --
+// Reports are only appended to session output buffers here; each session's
+// buffer then goes out in one writev on the next write, however many
+// reports the burst held.
+static void outboxcb(evutil_socket_t fd, short events, void *arg) {
+  reactor *r = static_cast<reactor *>(arg);
+
+  {
+    std::lock_guard<std::mutex> lock(r->outbox_m);
+    r->outbox.swap(r->outbox_flushing);
+  }
+
+  const char *cursor = r->outbox_flushing.data();
+  const char *end = cursor + r->outbox_flushing.size();
+  uint64_t count = 0;
+
+  while (cursor < end) {
+    uint64_t session_id;
+    frame_length_t length;
+
+    memcpy(&session_id, cursor, sizeof(session_id));
+    memcpy(&length, cursor + sizeof(session_id), sizeof(length));
+
+    const char *frame = cursor + sizeof(session_id);
+    cursor += sizeof(session_id) + sizeof(length) + length;
+
+    auto iter = r->sessions_by_id.find(session_id);
+    if (iter == r->sessions_by_id.end()) {
+      continue;
+    }
+
+    evbuffer_add(bufferevent_get_output(iter->second->bev), frame, sizeof(length) + length);
+    count++;
   }
+
+  r->outbox_flushing.clear();
+  r->reports_per_wakeup.collect(count);
 }
 
 static void errorcb(struct bufferevent *bev, short error, void *ctx) {
@@ -72,72 +483,256 @@ static void errorcb(struct bufferevent *bev, short error, void *ctx) {
 
   }
 
-  bufferevent_free(bev);
+  close_session(static_cast<session *>(ctx));
 }
 
-void do_accept(evutil_socket_t listener, short event, void *arg) {
-  struct event_base *base = static_cast<struct event_base *>(arg);
-  struct sockaddr_storage ss;
-  socklen_t slen = sizeof(ss);
-  int fd = accept(listener, reinterpret_cast<struct sockaddr *>(&ss), &slen);
+// --
+// Sessions cost a bufferevent, two empty evbuffers and a session until data arrives;
+// input chunks are allocated on read and released once drained.
+static std::shared_ptr<account> find_account(uint32_t address) {
+  std::lock_guard<std::mutex> lock(accounts_m);
 
-  if (fd < 0) {
-    LOG(ERROR) << "accept: " << strerror(errno);
+  // Kept for the gateway's lifetime, a client's budget survives reconnects
+  auto &acct = accounts[address];
+  if (!acct) {
+    acct = std::make_shared<account>(account_rate, account_burst);
   }
-  else if (fd > FD_SETSIZE) {
+
+  return acct;
+}
+
+// --
+static void add_session(reactor *r, int fd, const struct sockaddr_in &peer) {
+  struct bufferevent *bev = bufferevent_socket_new(r->base, fd, BEV_OPT_CLOSE_ON_FREE);
+  if (!bev) {
+    LOG(ERROR) << "Failed to create session";
     close(fd);
+    return;
   }
-  else {
-    LOG(INFO) << "Connection from client established";
-    struct bufferevent *bev;
-    evutil_make_socket_nonblocking(fd);
-    bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
-    bufferevent_setcb(bev, readcb, NULL, errorcb, NULL);
-    bufferevent_enable(bev, EV_READ|EV_WRITE);
 
-    int one = 1;
-    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  session *s = new session;
+  s->r = r;
+  s->id = ++r->next_session_id;
+  s->bev = bev;
+
+  if (session_rate > 0.0) {
+    s->bucket = make_unique<token_bucket>(session_rate, session_burst);
+  }
+
+  if (account_rate > 0.0) {
+    s->acct = find_account(peer.sin_addr.s_addr);
   }
+
+  r->sessions_by_id[s->id] = s;
+  r->sessions++;
+
+  bufferevent_setcb(bev, readcb, NULL, errorcb, s);
+  bufferevent_enable(bev, EV_READ|EV_WRITE);
+
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 }
 
-void fbgw_run() {
-  messaging = reinterpret_cast<messaging_t *>(find_service("messaging"));
+// --
+void do_accept(evutil_socket_t listener, short event, void *arg) {
+  reactor *r = static_cast<reactor *>(arg);
+
+  // Drain the backlog, bounded so established sessions still get a turn
+  for (int i = 0; i < accept_batch; ++i) {
+    struct sockaddr_in peer;
+    socklen_t peer_length = sizeof(peer);
+    int fd = accept4(listener, reinterpret_cast<struct sockaddr *>(&peer), &peer_length, SOCK_NONBLOCK);
+
+    if (fd >= 0) {
+      add_session(r, fd, peer);
+      continue;
+    }
+
+    if (errno == EINTR || errno == ECONNABORTED) {
+      continue;
+    }
+
+    if ((errno == EMFILE || errno == ENFILE) && r->spare_fd >= 0) {
+      // Out of fds: free the spare to take the connection off the backlog
+      // and close it, otherwise the listener stays readable and we spin
+      LOG_EVERY_N(WARNING, 1000) << "Out of file descriptors, refusing connections";
+      close(r->spare_fd);
+      close(accept(listener, nullptr, nullptr));
+      r->spare_fd = open("/dev/null", O_RDONLY);
+      continue;
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      LOG(ERROR) << "accept: " << strerror(errno);
+    }
 
-  evutil_socket_t listener;
+    break;
+  }
+}
+
+// --
+// Sessions are bounded by fds, not FD_SETSIZE; take the hard limit
+static void raise_fd_limit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+    LOG(ERROR) << "getrlimit: " << strerror(errno);
+    return;
+  }
+
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+      LOG(WARNING) << "Failed to raise fd limit: " << strerror(errno);
+      return;
+    }
+  }
+
+  LOG(INFO) << "File descriptor limit " << limit.rlim_cur;
+}
+
+// --
+static void statscb(evutil_socket_t fd, short events, void *arg) {
+  static std::string last;
+  static uint64_t last_rejected = 0, last_delayed = 0;
+
+  std::stringstream ss;
+  size_t total = 0;
+  uint64_t rejected = 0, delayed = 0;
+
+  for (auto &r : reactors) {
+    ss << (r->index ? " " : "") << r->sessions;
+    total += r->sessions;
+    rejected += r->throttle_rejected;
+    delayed += r->throttle_delayed;
+  }
+
+  if (rejected != last_rejected || delayed != last_delayed) {
+    LOG(INFO) << "fbgw_throttle: rejected=" << rejected - last_rejected << " delayed=" << delayed - last_delayed;
+    last_rejected = rejected;
+    last_delayed = delayed;
+  }
+
+  // Only when something changed, idle gateways stay quiet
+  if (ss.str() != last) {
+    LOG(INFO) << "fbgw_sessions: total=" << total << " per_reactor=[" << ss.str() << "]";
+    last = ss.str();
+  }
+}
+
+// --
+static void reactor_setup(reactor *r, uint16_t port) {
   struct sockaddr_in sin;
-  struct event_base *base;
 
-  base = event_base_new();
-  if (!base) {
+  // select and poll don't scale to this many sessions, insist on O(1) backends (epoll)
+  struct event_config *config = event_config_new();
+  event_config_avoid_method(config, "select");
+  event_config_avoid_method(config, "poll");
+  event_config_require_features(config, EV_FEATURE_O1);
+
+  r->base = event_base_new_with_config(config);
+  event_config_free(config);
+
+  if (!r->base) {
     LOG(ERROR) << "Failed to setup event_base";
-    return;
+    std::abort();
   }
 
   sin.sin_family = AF_INET;
   sin.sin_addr.s_addr = 0;
-  sin.sin_port = htons(48400);
+  sin.sin_port = htons(port);
 
-  listener = socket(AF_INET, SOCK_STREAM, 0);
-  evutil_make_socket_nonblocking(listener);
+  r->listener = socket(AF_INET, SOCK_STREAM, 0);
+  evutil_make_socket_nonblocking(r->listener);
 
   {
     int reuseaddr = 1;
-    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr));
+    setsockopt(r->listener, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr));
+
+    // Every reactor binds the same port, the kernel balances accepts
+    int reuseport = 1;
+    if (setsockopt(r->listener, SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport)) < 0) {
+      LOG(ERROR) << "Failed to set SO_REUSEPORT: " << strerror(errno);
+      std::abort();
+    }
   }
 
-  if (bind(listener, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+  if (bind(r->listener, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
     LOG(ERROR) << "bind: " << strerror(errno);
-    return;
+    std::abort();
   }
 
-  if (listen(listener, 16) < 0) {
+  if (listen(r->listener, read_variable<int>("FBGW_BACKLOG", SOMAXCONN)) < 0) {
     LOG(ERROR) << "listen: " << strerror(errno);
-    return;
+    std::abort();
   }
 
-  struct event *listener_event = event_new(base, listener, EV_READ|EV_PERSIST, do_accept, (void*)base);
-  event_add(listener_event, NULL);
+  r->listener_event = event_new(r->base, r->listener, EV_READ|EV_PERSIST, do_accept, r);
+  event_add(r->listener_event, NULL);
 
-  LOG(INFO) << "Started server at port " << ntohs(sin.sin_port);
-  event_base_dispatch(base);
+  r->resume_event = event_new(r->base, -1, 0, resumecb, r);
+  r->outbox_event = event_new(r->base, -1, 0, outboxcb, r);
+  r->spare_fd = open("/dev/null", O_RDONLY);
+}
+
+// --
+void fbgw_run() {
+  messaging = reinterpret_cast<messaging_t *>(find_service("messaging"));
+
+  // Reports and credit arrive on messaging's thread and wake the reactors
+  evthread_use_pthreads();
+
+  max_frame_size = read_variable<size_t>("FBGW_MAX_FRAME_SIZE", 1024);
+  accept_batch = std::max(read_variable<int>("FBGW_ACCEPT_BATCH", 64), 1);
+
+  verify_max_depth = read_variable<size_t>("FBGW_VERIFY_MAX_DEPTH", 8);
+  verify_max_tables = read_variable<size_t>("FBGW_VERIFY_MAX_TABLES", 64);
+
+  session_rate = read_variable<double>("FBGW_SESSION_RATE", 0.0);
+  session_burst = read_variable<double>("FBGW_SESSION_BURST", session_rate);
+  account_rate = read_variable<double>("FBGW_ACCOUNT_RATE", 0.0);
+  account_burst = read_variable<double>("FBGW_ACCOUNT_BURST", account_rate);
+
+  std::string throttle_mode = read_variable<std::string>("FBGW_THROTTLE", "delay");
+  if (throttle_mode != "delay" && throttle_mode != "reject") {
+    LOG(ERROR) << "Unknown FBGW_THROTTLE '" << throttle_mode << "'";
+    std::abort();
+  }
+  throttle_reject = throttle_mode == "reject";
+
+  raise_fd_limit();
+
+  uint16_t port = read_variable<uint16_t>("FBGW_PORT", 48400);
+  size_t count = std::max<size_t>(read_variable<size_t>("FBGW_REACTORS", 1), 1);
+
+  // All listeners exist before any loop runs, so no reactor misses connections
+  for (size_t i = 0; i < count; ++i) {
+    auto r = make_unique<reactor>();
+    r->index = i;
+    reactor_setup(r.get(), port);
+    reactors.push_back(std::move(r));
+  }
+
+  credit_cb.credit_available = credit_available;
+  messaging->register_credit_callback(&credit_cb, nullptr);
+
+  report_cb.received_message = received_report;
+  messaging->register_callback(&report_cb, nullptr);
+
+  struct timeval interval = {1, 0};
+  struct event *stats_event = event_new(reactors[0]->base, -1, EV_PERSIST, statscb, nullptr);
+  event_add(stats_event, &interval);
+
+  // The calling thread is reactor 0, the rest get a core each
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; ++i) {
+    threads.push_back(cpu_thread("fbgw-tcp", event_base_dispatch, reactors[i]->base));
+  }
+
+  LOG(INFO) << "Started server at port " << port << " with " << count << " reactors ("
+            << event_base_get_method(reactors[0]->base) << ")";
+  event_base_dispatch(reactors[0]->base);
+
+  for (auto &t : threads) {
+    t.join();
+  }
 }
@@ -13,6 +13,10 @@ typedef int status_t;
 #define SUC_INBOOK       10001 /* Order put in order book */
 #define SUC_EXECUTED     10002 /* Order completely executed */
 #define ERR_NOINS        -10001 /* No such instrument */
+#define ERR_MSGSIZE      -10002 /* Message too large for transport */
+#define ERR_TXFULL       -10003 /* Transmit buffer full, message not sent */
+#define ERR_INVALID      -10004 /* Order failed validation */
+#define ERR_THROTTLED    -10005 /* Rejected by gateway rate limits */
 
 #define SIDE_BUY  1
 #define SIDE_SELL 2
@@ -38,13 +42,23 @@ typedef struct matching_engine {
 
 
 // Messaging
+//
+// Everything on the bus is a verified api::Message. Producers fed from
+// outside (fbgw) run the FlatBuffers verifier before sending, so
+// subscribers can read messages without verifying them again.
 typedef struct messaging_callback {
   status_t (*received_message)(const void *data, size_t size);
 } messaging_callback_t;
 
+typedef struct messaging_credit_callback {
+  void (*credit_available)(void *opaque);
+} messaging_credit_callback_t;
+
 typedef struct messaging {
   status_t (*register_callback)(messaging_callback_t *callback, void *opaque);
   status_t (*send_message)(const void *data, size_t size);
+  size_t   (*tx_credit)(); /* Bytes that can be sent without ERR_TXFULL */
+  status_t (*register_credit_callback)(messaging_credit_callback_t *callback, void *opaque);
 } messaging_t;
 
 
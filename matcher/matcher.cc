@@ -5,30 +5,60 @@
 #include "api/apidef_generated.h"
 
 #include <glog/logging.h>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 static status_t dec_in_price(const char *ins_id, int *dec);
 static status_t limit_order(const char *ins_id, int side, unsigned quantity, uint64_t price, uint64_t *order_id);
 static status_t register_callback(const char *ins_id, void *opaque, matching_engine_callback_t *callback);
 
 static status_t received_message(const void *data, size_t size);
+static status_t order_matched(void *opaque, order_match_report_t *report);
+static void     credit_available(void *opaque);
+
+// Orders entered over messaging that rest in a book, by order id, so fills
+// can be reported against the client's local_id
+typedef struct resting_order {
+  uint64_t local_id;
+  unsigned leaves_quantity;
+} resting_order_t;
+
+typedef std::unordered_map<uint64_t, resting_order_t> resting_order_map;
 
 typedef std::map<std::string, std::unique_ptr<order_book>> order_book_map;
 static matching_engine_t service;
 static order_book_map order_books;
+static std::map<std::string, resting_order_map> resting_orders;
 static messaging_callback_t messaging_cb;
+static messaging_credit_callback_t credit_cb;
+static matching_engine_callback_t report_cb;
 static messaging_t *messaging;
 
+// The order from messaging being matched right now; it has no order id
+// until it rests, so its fills come back with order_id 0
+static struct {
+  uint64_t local_id;
+  unsigned leaves_quantity;
+} incoming;
+
+// Reports that didn't fit in the transport, sent once it has credit again
+static std::mutex backlog_m;
+static std::deque<std::vector<char>> backlog;
+
 static order_book *fetch_order_book(const char *ins_id) {
   auto iter = order_books.find({ins_id});
   if (iter != order_books.end()) {
     return iter->second.get();
   }
   else {
-    order_book_map::value_type pair = {{ins_id}, make_unique<order_book>(ins_id)};
-    return order_books.insert(std::move(pair)).first->second.get();
+    order_book *book = order_books.emplace(ins_id, make_unique<order_book>(ins_id)).first->second.get();
+    book->register_callback(&resting_orders[ins_id], &report_cb);
+    return book;
   }
 }
 
@@ -41,14 +71,23 @@ void matcher_init() {
 
   register_service("matcher", &service);
 
+  report_cb.order_matched = order_matched;
+
+  // Without messaging the matcher is only reachable as a service
   messaging = reinterpret_cast<messaging_t *>(find_service("messaging"));
-  messaging_cb.received_message = received_message;
-  messaging->register_callback(&messaging_cb, 0);
+  if (messaging) {
+    messaging_cb.received_message = received_message;
+    messaging->register_callback(&messaging_cb, 0);
+
+    credit_cb.credit_available = credit_available;
+    messaging->register_credit_callback(&credit_cb, nullptr);
+  }
 }
 
 void matcher_shutdown() {
   LOG(INFO) << "Shutting down matcher";
   order_books.clear();
+  resting_orders.clear();
   unregister_service("matcher", &service);
 }
 
@@ -69,19 +108,130 @@ status_t register_callback(const char *ins_id, void *opaque, matching_engine_cal
 }
 
 // --
-status_t received_message(const void *data, size_t size) {
-  const api::Message *msg = api::GetMessage(data);
-  if (msg->Body_type() == api::MessageType_LimitOrder) {
-    auto order = static_cast<const api::LimitOrder *>(msg->Body());
+static void publish(const void *data, size_t size) {
+  std::lock_guard<std::mutex> lock(backlog_m);
+
+  // Keep reports in order behind anything already waiting
+  if (backlog.empty() && messaging->send_message(data, size) != ERR_TXFULL) {
+    return;
+  }
+
+  const char *ptr = static_cast<const char *>(data);
+  backlog.emplace_back(ptr, ptr + size);
+}
+
+// --
+void credit_available(void *opaque) {
+  std::lock_guard<std::mutex> lock(backlog_m);
+
+  while (!backlog.empty()) {
+    if (messaging->send_message(backlog.front().data(), backlog.front().size()) == ERR_TXFULL) {
+      return;
+    }
+
+    backlog.pop_front();
+  }
+}
+
+// --
+static void send_report(const char *ins_id, uint64_t local_id, uint64_t order_id, api::ExecType exec_type,
+                        unsigned quantity, uint64_t price, unsigned leaves_quantity, status_t reason) {
+  if (!messaging) {
+    return;
+  }
+
+  static flatbuffers::FlatBufferBuilder builder(200);
+  builder.Clear();
+
+  auto ins = builder.CreateString(ins_id ? ins_id : "");
+
+  api::ExecutionReportBuilder report_builder(builder);
+  report_builder.add_ins_id(ins);
+  report_builder.add_local_id(local_id);
+  report_builder.add_order_id(order_id);
+  report_builder.add_exec_type(exec_type);
+  report_builder.add_quantity(quantity);
+  report_builder.add_price(price);
+  report_builder.add_leaves_quantity(leaves_quantity);
+  report_builder.add_reason(reason);
+  auto report = report_builder.Finish();
+
+  auto root = api::CreateMessage(builder, api::MessageType_ExecutionReport, report.Union());
+  builder.Finish(root);
 
-    if (order->local_id() % 10000) {
+  publish(builder.GetBufferPointer(), builder.GetSize());
+}
+
+// --
+status_t order_matched(void *opaque, order_match_report_t *report) {
+  resting_order_map &resting = *static_cast<resting_order_map *>(opaque);
+  uint64_t local_id;
+  unsigned leaves_quantity;
+
+  if (report->order_id == 0) {
+    incoming.leaves_quantity -= report->quantity;
+    local_id = incoming.local_id;
+    leaves_quantity = incoming.leaves_quantity;
+  }
+  else {
+    auto iter = resting.find(report->order_id);
+    if (iter == end(resting)) {
+      // Entered through the service, nobody to report back to
       return SUC_OK;
     }
 
-    /*    LOG(INFO) << "limit order side=" << order->side()
-              << ", quantity=" << order->quantity()
-              << ", price=" << order->price()
-              << ", local_id=" << order->local_id();*/
+    iter->second.leaves_quantity -= report->quantity;
+    local_id = iter->second.local_id;
+    leaves_quantity = iter->second.leaves_quantity;
+
+    if (leaves_quantity == 0) {
+      resting.erase(iter);
+    }
+  }
+
+  send_report(report->ins_id, local_id, report->order_id, api::ExecType_Fill,
+              report->quantity, report->price, leaves_quantity, SUC_OK);
+  return SUC_OK;
+}
+
+// --
+static void handle_limit_order(const api::LimitOrder *order) {
+  const char *ins_id = order->ins_id() ? order->ins_id()->c_str() : nullptr;
+  int side = order->side() == api::SideType_Buy ? SIDE_BUY : order->side() == api::SideType_Sell ? SIDE_SELL : 0;
+
+  if (!ins_id || side == 0 || order->quantity() == 0) {
+    send_report(ins_id, order->local_id(), 0, api::ExecType_Rejected, 0, order->price(), 0, ERR_INVALID);
+    return;
+  }
+
+  incoming.local_id = order->local_id();
+  incoming.leaves_quantity = order->quantity();
+
+  uint64_t order_id = 0;
+  status_t status = limit_order(ins_id, side, order->quantity(), order->price(), &order_id);
+
+  if (FAILED(status)) {
+    send_report(ins_id, order->local_id(), 0, api::ExecType_Rejected, 0, order->price(), 0, status);
+  }
+  else if (status == SUC_INBOOK) {
+    resting_orders[ins_id][order_id] = {incoming.local_id, incoming.leaves_quantity};
+    send_report(ins_id, order->local_id(), order_id, api::ExecType_New, 0, order->price(), incoming.leaves_quantity, status);
+  }
+}
+
+// --
+status_t received_message(const void *data, size_t size) {
+  // Verified where it entered the bus
+  const api::Message *msg = api::GetMessage(data);
+
+  switch (msg->Body_type()) {
+  case api::MessageType_LimitOrder:
+    handle_limit_order(static_cast<const api::LimitOrder *>(msg->Body()));
+    break;
+
+  default:
+    // Our own reports loop back too
+    break;
   }
 
   return SUC_OK;
@@ -3,7 +3,9 @@
 #include <glog/logging.h>
 #include <algorithm>
 
-order_book::order_book(const char *ins_id) {
+order_book::order_book(const char *ins_id)
+  : ins_id(ins_id)
+{
   LOG(INFO) << "Creating order book '" << ins_id << "'";
   latest_order_id = 0;
 }
@@ -98,5 +100,5 @@ void order_book::save_order(const order &order) {
 }
 
 uint64_t order_book::allocate_order_id() {
-  ++latest_order_id;
+  return ++latest_order_id;
 }
@@ -0,0 +1,160 @@
+#include "capture.h"
+
+#include <glog/logging.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <chrono>
+#include <thread>
+
+// --
+static uint64_t realtime_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// --
+capture_writer::capture_writer(FILE *file)
+  : file(file)
+{
+}
+
+// --
+capture_writer::~capture_writer() {
+  fclose(file);
+  LOG(INFO) << "Captured " << records << " datagrams";
+}
+
+// --
+std::shared_ptr<capture_writer> capture_writer::open(const std::string &path) {
+  static std::mutex m;
+  static std::map<std::string, std::weak_ptr<capture_writer>> writers;
+
+  std::lock_guard<std::mutex> lock(m);
+
+  auto writer = writers[path].lock();
+  if (writer) {
+    return writer;
+  }
+
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file) {
+    LOG(ERROR) << "Failed to open capture file " << path << ": " << strerror(errno);
+    std::abort();
+  }
+
+  setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+  capture_file_header_t header = {CAPTURE_MAGIC, CAPTURE_VERSION, 0};
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    LOG(ERROR) << "Failed to write capture header to " << path;
+    std::abort();
+  }
+
+  LOG(INFO) << "Capturing received datagrams to " << path;
+
+  writer.reset(new capture_writer(file));
+  writers[path] = writer;
+  return writer;
+}
+
+// --
+void capture_writer::append(const struct sockaddr_in &group, const char *data, size_t size) {
+  capture_record_t record;
+  record.group = group.sin_addr.s_addr;
+  record.port = group.sin_port;
+  record.size = size;
+
+  // Stamped under the lock so records stay in time order across threads
+  std::lock_guard<std::mutex> lock(m);
+  record.timestamp_ns = realtime_ns();
+
+  if (fwrite(&record, sizeof(record), 1, file) != 1 || fwrite(data, 1, size, file) != size) {
+    LOG_EVERY_N(ERROR, 1000) << "Failed to write capture record: " << strerror(errno);
+    return;
+  }
+
+  records++;
+
+  // Bounds what's lost if we die, without a syscall per datagram
+  if (record.timestamp_ns - last_flush_ns > 100000000) {
+    fflush(file);
+    last_flush_ns = record.timestamp_ns;
+  }
+}
+
+// --
+capture_reader::capture_reader(const std::string &path) {
+  file = fopen(path.c_str(), "rb");
+  if (!file) {
+    LOG(ERROR) << "Failed to open capture file " << path << ": " << strerror(errno);
+    std::abort();
+  }
+
+  capture_file_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CAPTURE_MAGIC) {
+    LOG(ERROR) << path << " is not a capture file";
+    std::abort();
+  }
+
+  if (header.version != CAPTURE_VERSION) {
+    LOG(ERROR) << "Unsupported capture version " << header.version << " in " << path;
+    std::abort();
+  }
+}
+
+// --
+capture_reader::~capture_reader() {
+  fclose(file);
+}
+
+// --
+bool capture_reader::next(capture_record_t &record, std::vector<char> &data) {
+  if (fread(&record, sizeof(record), 1, file) != 1) {
+    return false;
+  }
+
+  data.resize(record.size);
+  if (fread(data.data(), 1, record.size, file) != record.size) {
+    LOG(WARNING) << "Truncated capture record, stopping";
+    return false;
+  }
+
+  return true;
+}
+
+// --
+uint64_t replay_capture(const std::string &path, double speed, const replay_fn &fn) {
+  typedef std::chrono::steady_clock clock;
+
+  capture_reader reader(path);
+  capture_record_t record;
+  std::vector<char> data;
+  uint64_t count = 0, first_ns = 0;
+  clock::time_point start;
+
+  while (reader.next(record, data)) {
+    if (count++ == 0) {
+      first_ns = record.timestamp_ns;
+      start = clock::now();
+    }
+
+    if (speed > 0.0) {
+      auto offset = std::chrono::nanoseconds(static_cast<int64_t>((record.timestamp_ns - first_ns) / speed));
+      auto due = start + offset;
+
+      // Sleep off long gaps, spin the last stretch so pacing stays tight
+      if (due - clock::now() > std::chrono::microseconds(200)) {
+        std::this_thread::sleep_until(due - std::chrono::microseconds(100));
+      }
+
+      while (clock::now() < due);
+    }
+
+    fn(record, data.data(), data.size());
+  }
+
+  return count;
+}
@@ -0,0 +1,85 @@
+// -*- c++ -*-
+
+#ifndef _MESSAGING_CAPTURE_H
+#define _MESSAGING_CAPTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+/*
+ * Capture file: a header followed by one record per datagram, exactly as it
+ * arrived on the group, with the CLOCK_REALTIME receive time.
+ *
+ *   capture_file_header_t
+ *   capture_record_t, <size bytes of datagram>
+ *   capture_record_t, <size bytes of datagram>
+ *   ...
+ *
+ * Host byte order, except group and port which are kept as in sockaddr_in.
+ */
+#define CAPTURE_MAGIC 0x4d4d4350
+#define CAPTURE_VERSION 1
+
+typedef struct capture_file_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+} capture_file_header_t;
+
+typedef struct capture_record {
+  uint64_t timestamp_ns;
+  uint32_t group;
+  uint16_t port;
+  uint16_t size;
+} capture_record_t;
+
+/*
+ * Appends datagrams to a capture file. Connections capturing to the same
+ * path share one writer, records from different groups are interleaved.
+ */
+class capture_writer {
+public:
+  ~capture_writer();
+
+  static std::shared_ptr<capture_writer> open(const std::string &path);
+
+  // Thread safe
+  void append(const struct sockaddr_in &group, const char *data, size_t size);
+
+private:
+  explicit capture_writer(FILE *file);
+
+  std::mutex m;
+  FILE *file;
+  uint64_t last_flush_ns = 0;
+  uint64_t records = 0;
+};
+
+class capture_reader {
+public:
+  explicit capture_reader(const std::string &path);
+  ~capture_reader();
+
+  // False at end of file, a truncated last record counts as the end
+  bool next(capture_record_t &record, std::vector<char> &data);
+
+private:
+  FILE *file;
+};
+
+/*
+ * Feeds every record in a capture to fn. With speed 1.0 the original gaps
+ * between receive times are kept, 2.0 halves them, and 0 sends flat out.
+ * Returns the number of records replayed.
+ */
+typedef std::function<void(const capture_record_t &, char *, size_t)> replay_fn;
+uint64_t replay_capture(const std::string &path, double speed, const replay_fn &fn);
+
+#endif // !_MESSAGING_CAPTURE_H
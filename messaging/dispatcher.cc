@@ -0,0 +1,61 @@
+#include "dispatcher.h"
+#include "utils/thread.h"
+
+#include <glog/logging.h>
+#include <sstream>
+
+// --
+static std::string next_depth_name() {
+  static std::atomic<int> next_id(0);
+
+  std::stringstream ss;
+  ss << "msg_dispatch_depth_bytes[" << next_id++ << "]";
+  return ss.str();
+}
+
+// --
+dispatcher::dispatcher(messaging_callback_t *callback, size_t ring_size)
+  : callback(callback)
+  , ring(ring_size)
+  , running(true)
+  , depth_name(next_depth_name())
+  , depth(depth_name.c_str())
+{
+  thread = cpu_thread("msg-dispatch", &dispatcher::run, this);
+}
+
+// --
+dispatcher::~dispatcher() {
+  running = false;
+  thread.join();
+}
+
+// --
+void dispatcher::enqueue(const void *data, size_t size) {
+  depth.collect(ring.depth());
+
+  if (ring.push(data, size)) {
+    return;
+  }
+
+  if (++stalls % 1000 == 1) {
+    LOG(WARNING) << depth_name << " full, messaging thread stalled " << stalls << " times";
+  }
+
+  while (!ring.push(data, size)) {
+    std::this_thread::yield();
+  }
+}
+
+// --
+void dispatcher::run() {
+  LOG(INFO) << "Dispatch thread starting";
+
+  while (running.load(std::memory_order_relaxed)) {
+    ring.pop([this](const void *data, size_t size) {
+      callback->received_message(data, size);
+    });
+  }
+
+  LOG(INFO) << "Dispatch thread exiting";
+}
@@ -0,0 +1,41 @@
+// -*- c++ -*-
+
+#ifndef _MESSAGING_DISPATCHER_H
+#define _MESSAGING_DISPATCHER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "framework/services.h"
+#include "utils/spsc_ring.h"
+#include "utils/timing.h"
+
+/*
+ * Runs one subscriber's callbacks on its own pinned thread, fed through an
+ * SPSC ring by the messaging thread. A slow subscriber then only fills its
+ * own ring instead of holding up socket reads for everyone.
+ */
+class dispatcher {
+public:
+  dispatcher(messaging_callback_t *callback, size_t ring_size);
+  ~dispatcher();
+
+  // Messaging thread only. Waits for room if the subscriber is behind.
+  void enqueue(const void *data, size_t size);
+
+private:
+  void run();
+
+  messaging_callback_t *callback;
+  spsc_ring ring;
+  std::atomic<bool> running;
+
+  std::string depth_name;
+  distribution depth;
+  uint64_t stalls = 0;
+
+  std::thread thread;
+};
+
+#endif // !_MESSAGING_DISPATCHER_H
@@ -0,0 +1,149 @@
+#include "fault_injector.h"
+#include "utils/variables.h"
+
+#include <glog/logging.h>
+#include <string>
+
+// --
+static void timercb(evutil_socket_t fd, short events, void *opaque);
+
+// --
+bool fault_config::enabled() const {
+  return drop_rate > 0.0 || duplicate_rate > 0.0 || delay.count() > 0 || reorder_window.count() > 0;
+}
+
+// --
+fault_config_t fault_config::from_variables(const char *prefix) {
+  std::string p(prefix);
+  fault_config_t config;
+
+  config.drop_rate = read_variable<double>((p + "DROP").c_str(), 0.0);
+  config.duplicate_rate = read_variable<double>((p + "DUPLICATE").c_str(), 0.0);
+  config.delay = std::chrono::microseconds(read_variable<int>((p + "DELAY_US").c_str(), 0));
+  config.reorder_window = std::chrono::microseconds(read_variable<int>((p + "REORDER_US").c_str(), 0));
+  config.seed = read_variable<uint64_t>((p + "SEED").c_str(), 1);
+
+  return config;
+}
+
+// --
+fault_injector::fault_injector(const fault_config_t &config, const deliver_fn &deliver)
+  : config(config)
+  , deliver(deliver)
+  , rng(config.seed)
+  , chance(0.0, 1.0)
+{
+  LOG(INFO) << "Injecting faults: drop=" << config.drop_rate
+            << " duplicate=" << config.duplicate_rate
+            << " delay_us=" << config.delay.count()
+            << " reorder_us=" << config.reorder_window.count()
+            << " seed=" << config.seed;
+}
+
+// --
+fault_injector::~fault_injector() {
+  if (timer_event) {
+    event_free(timer_event);
+  }
+
+  LOG(INFO) << "Fault injector dropped " << dropped_count << ", duplicated " << duplicated_count;
+}
+
+// --
+void fault_injector::join(struct event_base *base) {
+  timer_event = event_new(base, -1, 0, ::timercb, this);
+  if (!timer_event) {
+    LOG(ERROR) << "Failed to create fault injector timer";
+    std::abort();
+  }
+}
+
+// --
+void fault_injector::inject(const char *data, size_t size) {
+  auto now = clock::now();
+  clock::time_point next_due;
+
+  {
+    std::lock_guard<std::mutex> lock(m);
+
+    if (chance(rng) < config.drop_rate) {
+      dropped_count++;
+      return;
+    }
+
+    int copies = 1;
+    if (chance(rng) < config.duplicate_rate) {
+      duplicated_count++;
+      copies = 2;
+    }
+
+    for (int i = 0; i < copies; ++i) {
+      auto due = now + config.delay;
+      if (config.reorder_window.count() > 0) {
+        due += std::chrono::microseconds(rng() % config.reorder_window.count());
+      }
+
+      pending.push({due, next_order++, std::vector<char>(data, data + size)});
+    }
+  }
+
+  next_due = release(now);
+
+  if (next_due != clock::time_point::max()) {
+    schedule(next_due);
+  }
+}
+
+// --
+fault_injector::clock::time_point fault_injector::release(clock::time_point now) {
+  std::vector<std::vector<char>> due;
+  clock::time_point next_due = clock::time_point::max();
+
+  {
+    std::lock_guard<std::mutex> lock(m);
+
+    while (!pending.empty() && pending.top().due <= now) {
+      due.push_back(std::move(const_cast<held &>(pending.top()).data));
+      pending.pop();
+    }
+
+    if (!pending.empty()) {
+      next_due = pending.top().due;
+    }
+  }
+
+  for (auto &datagram : due) {
+    deliver(datagram.data(), datagram.size());
+  }
+
+  return next_due;
+}
+
+// --
+void fault_injector::schedule(clock::time_point due) {
+  if (!timer_event) {
+    return;
+  }
+
+  auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(due - clock::now());
+  long usec = std::max<long>(remaining.count(), 0);
+
+  struct timeval tv;
+  tv.tv_sec = usec / 1000000;
+  tv.tv_usec = usec % 1000000;
+  event_add(timer_event, &tv);
+}
+
+// --
+void fault_injector::timercb() {
+  auto next_due = release(clock::now());
+
+  if (next_due != clock::time_point::max()) {
+    schedule(next_due);
+  }
+}
+
+// --
+void timercb(evutil_socket_t fd, short events, void *opaque) {
+  static_cast<fault_injector *>(opaque)->timercb();
+}
@@ -0,0 +1,84 @@
+// -*- c++ -*-
+
+#ifndef _MESSAGING_FAULT_INJECTOR_H
+#define _MESSAGING_FAULT_INJECTOR_H
+
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include <event2/event.h>
+
+/*
+ * Network impairments for a datagram stream: loss, duplication, added delay
+ * and reordering (a random extra delay within a window, so datagrams closer
+ * than that may swap). Decisions come from a seeded PRNG so runs repeat.
+ */
+typedef struct fault_config {
+  double drop_rate = 0.0;
+  double duplicate_rate = 0.0;
+  std::chrono::microseconds delay{0};
+  std::chrono::microseconds reorder_window{0};
+  uint64_t seed = 1;
+
+  bool enabled() const;
+
+  // <prefix>DROP, <prefix>DUPLICATE, <prefix>DELAY_US, <prefix>REORDER_US, <prefix>SEED
+  static fault_config from_variables(const char *prefix);
+} fault_config_t;
+
+class fault_injector {
+public:
+  typedef std::chrono::high_resolution_clock clock;
+  typedef std::function<void(char *, size_t)> deliver_fn;
+
+  fault_injector(const fault_config_t &config, const deliver_fn &deliver);
+  ~fault_injector();
+
+  // Held datagrams are released from a timer on this base
+  void join(struct event_base *base);
+
+  // Thread safe. Delivers now, later (from the timer), twice or never.
+  void inject(const char *data, size_t size);
+
+  // Delivers everything due by now, returns when the next one is due
+  clock::time_point release(clock::time_point now);
+
+  uint64_t dropped() const { return dropped_count; }
+  uint64_t duplicated() const { return duplicated_count; }
+
+  void timercb();
+
+private:
+  struct held {
+    clock::time_point due;
+    uint64_t order;
+    std::vector<char> data;
+
+    bool operator <(const held &other) const {
+      return due != other.due ? due > other.due : order > other.order;
+    }
+  };
+
+  void schedule(clock::time_point due);
+
+  fault_config_t config;
+  deliver_fn deliver;
+
+  std::mutex m;
+  std::mt19937_64 rng;
+  std::uniform_real_distribution<double> chance;
+  std::priority_queue<held> pending;
+  uint64_t next_order = 0;
+
+  uint64_t dropped_count = 0;
+  uint64_t duplicated_count = 0;
+
+  struct event *timer_event = nullptr;
+};
+
+#endif // !_MESSAGING_FAULT_INJECTOR_H
@@ -0,0 +1,145 @@
+#include "id_source.h"
+#include "utils/memory.h"
+#include "utils/variables.h"
+
+#include <hiredis/hiredis.h>
+#include <glog/logging.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <limits>
+#include <mutex>
+#include <algorithm>
+
+// --
+redis_id_source::redis_id_source(const char *address, int port)
+  : address(address)
+  , port(port)
+{
+}
+
+// --
+uint16_t redis_id_source::allocate(uint16_t count) {
+  redisContext *ctx = redisConnect(address.c_str(), port);
+
+  if (!ctx || ctx->err) {
+    if (ctx) {
+      LOG(ERROR) << "Failed to create Redis context: " << ctx->err;
+    }
+    else {
+      LOG(ERROR) << "Failed to allocate Redis context";
+    }
+
+    std::abort();
+  }
+
+  redisReply *reply = reinterpret_cast<redisReply *>(redisCommand(ctx, "INCRBY msg_seq_id %d", count));
+  if (!reply) {
+    LOG(ERROR) << "Failed to send Redis command: " << ctx->err;
+    std::abort();
+  }
+
+  if (reply->type != REDIS_REPLY_INTEGER ||
+      reply->integer < count ||
+      reply->integer >= std::numeric_limits<uint16_t>::max()) {
+    LOG(ERROR) << "Unexpected seq id reply from Redis";
+    std::abort();
+  }
+
+  uint16_t first = reply->integer - count + 1;
+  freeReplyObject(reply);
+
+  int quorum = read_variable<int>("MSG_QUORUM", 0);
+  if (quorum != 0) {
+    reply = reinterpret_cast<redisReply *>(redisCommand(ctx, "WAIT %d 0", quorum));
+    if (!reply) {
+      LOG(ERROR) << "Failed to send Redis command: " << ctx->err;
+      std::abort();
+    }
+
+    if (reply->type != REDIS_REPLY_INTEGER || reply->integer != quorum) {
+      LOG(ERROR) << "Failed to reach consensus";
+      std::abort();
+    }
+
+    freeReplyObject(reply);
+  }
+
+  redisFree(ctx);
+  return first;
+}
+
+// --
+file_id_source::file_id_source(const char *path)
+  : path(path)
+{
+}
+
+// --
+uint16_t file_id_source::allocate(uint16_t count) {
+  int fd = open(path.c_str(), O_CREAT|O_RDWR, 0666);
+  if (fd < 0) {
+    LOG(ERROR) << "Failed to open id file " << path << ": " << strerror(errno);
+    std::abort();
+  }
+
+  if (flock(fd, LOCK_EX) < 0) {
+    LOG(ERROR) << "Failed to lock id file " << path << ": " << strerror(errno);
+    std::abort();
+  }
+
+  char buffer[32] = {0};
+  ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  uint64_t last = n > 0 ? strtoull(buffer, nullptr, 10) : 0;
+
+  if (last + count >= std::numeric_limits<uint16_t>::max()) {
+    LOG(ERROR) << "Seq ids in " << path << " exhausted, remove the file once all nodes are restarted";
+    std::abort();
+  }
+
+  int len = snprintf(buffer, sizeof(buffer), "%llu\n", static_cast<unsigned long long>(last + count));
+  if (ftruncate(fd, 0) < 0 || pwrite(fd, buffer, len, 0) != len) {
+    LOG(ERROR) << "Failed to update id file " << path << ": " << strerror(errno);
+    std::abort();
+  }
+
+  // Closing drops the lock
+  close(fd);
+  return last + 1;
+}
+
+// --
+uint16_t allocate_seq_id() {
+  static std::mutex m;
+  static std::unique_ptr<id_source> source;
+  static uint16_t next_id = 0, end_id = 0;
+
+  std::lock_guard<std::mutex> lock(m);
+
+  if (!source) {
+    std::string backend = read_variable<std::string>("MSG_ID_SOURCE", "redis");
+
+    if (backend == "file") {
+      source = make_unique<file_id_source>(read_variable<const char *>("MSG_ID_FILE", "/dev/shm/minimatch_seq_id"));
+    }
+    else if (backend == "redis") {
+      source = make_unique<redis_id_source>(read_variable<const char *>("MSG_ID_SOURCE_ADDR", "127.0.0.1"),
+                                            read_variable("MSG_ID_SOURCE_PORT", 6379));
+    }
+    else {
+      LOG(ERROR) << "Unknown id source '" << backend << "'";
+      std::abort();
+    }
+  }
+
+  if (next_id == end_id) {
+    uint16_t batch = std::max<uint16_t>(read_variable<uint16_t>("MSG_ID_BATCH", 1), 1);
+    next_id = source->allocate(batch);
+    end_id = next_id + batch;
+  }
+
+  return next_id++;
+}
@@ -0,0 +1,54 @@
+// -*- c++ -*-
+
+#ifndef _MESSAGING_ID_SOURCE_H
+#define _MESSAGING_ID_SOURCE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+ * Hands out sequence ids (seq_id in sequence_numbers). Ids must never be
+ * reused while receivers may still remember the last seq num seen for them.
+ */
+class id_source {
+public:
+  virtual ~id_source() {}
+
+  // Reserves count consecutive ids, returns the first one
+  virtual uint16_t allocate(uint16_t count) = 0;
+};
+
+/*
+ * Global counter in Redis (INCRBY msg_seq_id), optionally waiting for
+ * MSG_QUORUM replicas to acknowledge. Unique across hosts.
+ */
+class redis_id_source : public id_source {
+public:
+  redis_id_source(const char *address, int port);
+  uint16_t allocate(uint16_t count) override;
+
+private:
+  std::string address;
+  int port;
+};
+
+/*
+ * Counter in a local file, serialized with flock. Unique on this host only,
+ * so use it for single box setups and tests.
+ */
+class file_id_source : public id_source {
+public:
+  explicit file_id_source(const char *path);
+  uint16_t allocate(uint16_t count) override;
+
+private:
+  std::string path;
+};
+
+// Id for a new sequence_numbers instance. Backend is MSG_ID_SOURCE (redis or
+// file); with MSG_ID_BATCH > 1 ids are reserved in blocks and handed out
+// locally, so only the first connection in a process pays for a round trip.
+uint16_t allocate_seq_id();
+
+#endif // !_MESSAGING_ID_SOURCE_H
@@ -2,22 +2,25 @@
 #include "framework/services.h"
 #include "utils/blocking_queue.h"
 #include "utils/memory.h"
+#include "utils/rcu_list.h"
 
 #include <glog/logging.h>
 #include <thread>
 #include <memory>
-#include <set>
+#include <limits>
 
 // --
 static status_t register_callback(messaging_callback_t *cb, void *opaque);
 static status_t send_message(const void *data, size_t size);
+static size_t   tx_credit();
+static status_t register_credit_callback(messaging_credit_callback_t *cb, void *opaque);
 
 // --
 typedef std::vector<char> message;
 static std::thread looper;
 static void eventloop();
 static blocking_queue<std::unique_ptr<message>> messages;
-static std::set<messaging_callback_t *> callbacks;
+static rcu_list<messaging_callback_t *> callbacks;
 
 static messaging_t service;
 
@@ -27,6 +30,8 @@ void loopback_messaging_init() {
 
   service.register_callback = register_callback;
   service.send_message = send_message;
+  service.tx_credit = tx_credit;
+  service.register_credit_callback = register_credit_callback;
 
   register_service("loopback_messaging", &service);
 
@@ -54,6 +59,17 @@ status_t send_message(const void *data, size_t size) {
   return SUC_OK;
 }
 
+// --
+size_t tx_credit() {
+  return std::numeric_limits<size_t>::max();
+}
+
+// --
+status_t register_credit_callback(messaging_credit_callback_t *cb, void *opaque) {
+  // Queue is unbounded, credit never runs out
+  return SUC_OK;
+}
+
 // --
 void eventloop() {
   LOG(INFO) << "Loopback messaging thread starting";
@@ -61,9 +77,9 @@ void eventloop() {
   while (1) {
     auto message = messages.pop();
 
-    for (auto &cb : callbacks) {
+    callbacks.for_each([&](messaging_callback_t *cb) {
       cb->received_message(message->data(), message->size());
-    }
+    });
   }
 
   LOG(INFO) << "Loopback messaging thread exiting";
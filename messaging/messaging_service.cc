@@ -1,38 +1,64 @@
 #include "messaging_service.h"
 #include "multicast_connection.h"
+#include "dispatcher.h"
 
 #include "framework/services.h"
 #include "utils/memory.h"
+#include "utils/rcu_list.h"
 #include "utils/thread.h"
 #include "utils/variables.h"
 #include "utils/timing.h"
+#include "api/apidef_generated.h"
 
 #include <glog/logging.h>
-#include <mutex>
-#include <set>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 #include <cassert>
+#include <mutex>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 #include <event2/event.h>
+#include <event2/thread.h>
 #include <iostream>
 
 // --
 static status_t register_callback(messaging_callback_t *cb, void *opaque);
 static status_t send_message(const void *data, size_t size);
+static size_t   tx_credit();
+static status_t register_credit_callback(messaging_credit_callback_t *cb, void *opaque);
 static void     on_read(const void *data, size_t size);
+static void     on_credit();
+static size_t   select_channel(const void *data, size_t size);
+static void     pollloop(std::chrono::microseconds spin_budget);
 
 // --
 static messaging_t service = {
   register_callback,
-  send_message
+  send_message,
+  tx_credit,
+  register_credit_callback
 };
 
 // --
-static std::unique_ptr<multicast_connection> mc_conn;
+// Messages are partitioned over channels (multicast groups) by instrument
+static std::vector<std::unique_ptr<multicast_connection>> channels;
+static std::unordered_map<std::string, size_t> instrument_channels;
 static std::thread eventloop;
+static std::atomic<bool> running;
 
-static std::mutex cb_mutex;
-static std::set<messaging_callback_t *> callbacks;
+static rcu_list<messaging_callback_t *> callbacks;
+
+// With MSG_DISPATCH_THREADS, subscribers run on their own threads instead
+static bool use_dispatchers = false;
+static rcu_list<dispatcher *> dispatchers;
+static std::mutex dispatchers_m;
+static std::vector<std::unique_ptr<dispatcher>> dispatcher_storage;
+static rcu_list<std::pair<messaging_credit_callback_t *, void *>> credit_callbacks;
 
 static struct event_base *base = nullptr;
 
@@ -41,20 +67,86 @@ void messaging_init() {
   LOG(INFO) << "Initializing messaging";
   register_service("messaging", &service);
 
+  use_dispatchers = read_variable<bool>("MSG_DISPATCH_THREADS", false);
+
+  // Publishers activate the flush event from their own threads
+  evthread_use_pthreads();
+
   base = event_base_new();
   assert(base && "Failed to create event base");
 
-  mc_conn = make_unique<multicast_connection>("239.0.0.1", 40100);
-  mc_conn->on_read = on_read;
+  // MSG_CHANNELS="group:port,group:port,..."
+  for (auto &channel : split(read_variable<std::string>("MSG_CHANNELS", "239.0.0.1:40100"), ',')) {
+    auto parts = split(channel, ':');
+    if (parts.size() != 2) {
+      LOG(ERROR) << "Failed to parse channel '" << channel << "'";
+      std::abort();
+    }
+
+    channels.push_back(make_unique<multicast_connection>(parts[0].c_str(), convert<uint16_t>(parts[1].c_str())));
+    LOG(INFO) << "Channel " << channels.size() - 1 << ": " << channel;
+  }
+
+  // MSG_INSTRUMENT_CHANNELS="ins_id=channel,...", unmapped instruments go to channel 0
+  for (auto &mapping : split(read_variable<std::string>("MSG_INSTRUMENT_CHANNELS", ""), ',')) {
+    auto parts = split(mapping, '=');
+    size_t channel = parts.size() == 2 ? convert<size_t>(parts[1].c_str()) : channels.size();
 
-  if (read_variable<bool>("MSG_BUFFER_TX", true)) {
-    mc_conn->join(base, base);
+    if (channel >= channels.size()) {
+      LOG(ERROR) << "Failed to parse instrument mapping '" << mapping << "'";
+      std::abort();
+    }
+
+    instrument_channels[parts[0]] = channel;
+  }
+
+  // MSG_SUBSCRIBE="channel,...", defaults to all channels
+  std::vector<bool> subscribed(channels.size(), true);
+  auto subscriptions = split(read_variable<std::string>("MSG_SUBSCRIBE", ""), ',');
+
+  if (!subscriptions.empty()) {
+    std::fill(begin(subscribed), end(subscribed), false);
+
+    for (auto &channel : subscriptions) {
+      size_t idx = convert<size_t>(channel.c_str());
+      if (idx >= channels.size()) {
+        LOG(ERROR) << "No such channel " << channel;
+        std::abort();
+      }
+
+      subscribed[idx] = true;
+    }
+  }
+
+  bool buffer_tx = read_variable<bool>("MSG_BUFFER_TX", true);
+
+  for (size_t i = 0; i < channels.size(); ++i) {
+    channels[i]->on_read = on_read;
+    channels[i]->on_credit = on_credit;
+    channels[i]->join(subscribed[i] ? base : nullptr, buffer_tx ? base : nullptr);
+  }
+
+  // MSG_POLL_MODE=block parks in epoll between datagrams, spin never sleeps,
+  // hybrid spins for MSG_POLL_SPIN_US after the last datagram, then parks
+  std::string poll_mode = read_variable<std::string>("MSG_POLL_MODE", "block");
+  running = true;
+
+  if (poll_mode == "block") {
+    eventloop = std::move(cpu_thread("messaging", event_base_dispatch, base));
+  }
+  else if (poll_mode == "spin") {
+    eventloop = std::move(cpu_thread("messaging", pollloop, std::chrono::microseconds::max()));
+  }
+  else if (poll_mode == "hybrid") {
+    auto spin_budget = std::chrono::microseconds(read_variable<int>("MSG_POLL_SPIN_US", 50));
+    eventloop = std::move(cpu_thread("messaging", pollloop, spin_budget));
   }
   else {
-    mc_conn->join(base, nullptr);
+    LOG(ERROR) << "Unknown poll mode '" << poll_mode << "'";
+    std::abort();
   }
 
-  eventloop = std::move(cpu_thread("messaging", event_base_dispatch, base));
+  LOG(INFO) << "Messaging event loop in " << poll_mode << " mode";
 }
 
 // --
@@ -62,37 +154,136 @@ void messaging_shutdown() {
   LOG(INFO) << "Shutting down messaging";
   unregister_service("messaging", &service);
 
+  // The loopexit also wakes a parked poll loop
+  running = false;
   event_base_loopexit(base, nullptr);
   eventloop.join();
 
-  if (mc_conn) {
-    mc_conn->leave();
-    mc_conn.reset();
+  for (auto &channel : channels) {
+    channel->leave();
   }
+
+  channels.clear();
+  instrument_channels.clear();
+
+  dispatchers.clear();
+  std::lock_guard<std::mutex> lock(dispatchers_m);
+  dispatcher_storage.clear();
 }
 
 // --
 status_t register_callback(messaging_callback_t *cb, void *opaque) {
-  std::lock_guard<std::mutex> lock(cb_mutex);
-  callbacks.insert(cb);
+  if (!use_dispatchers) {
+    callbacks.insert(cb);
+    return SUC_OK;
+  }
+
+  std::lock_guard<std::mutex> lock(dispatchers_m);
+  auto d = make_unique<dispatcher>(cb, read_variable<size_t>("MSG_DISPATCH_RING_SIZE", 1 << 22));
+  dispatchers.insert(d.get());
+  dispatcher_storage.push_back(std::move(d));
   return SUC_OK;
 }
 
 // --
 status_t send_message(const void *data, size_t size) {
-  assert(mc_conn && "No multicast connection established");
-  mc_conn->send(data, size);
+  assert(!channels.empty() && "No multicast connection established");
+  return channels[select_channel(data, size)]->send(data, size);
+}
+
+// --
+size_t tx_credit() {
+  // Channel isn't known up front, so report the tightest one
+  size_t credit = std::numeric_limits<size_t>::max();
+
+  for (auto &channel : channels) {
+    credit = std::min(credit, channel->credit());
+  }
+
+  return credit;
+}
+
+// --
+status_t register_credit_callback(messaging_credit_callback_t *cb, void *opaque) {
+  credit_callbacks.insert({cb, opaque});
   return SUC_OK;
 }
 
+// --
+size_t select_channel(const void *data, size_t size) {
+  if (instrument_channels.empty()) {
+    return 0;
+  }
+
+  const api::Message *msg = api::GetMessage(data);
+  const flatbuffers::String *ins_id = nullptr;
+
+  if (msg->Body_type() == api::MessageType_LimitOrder) {
+    ins_id = static_cast<const api::LimitOrder *>(msg->Body())->ins_id();
+  }
+  else if (msg->Body_type() == api::MessageType_ExecutionReport) {
+    ins_id = static_cast<const api::ExecutionReport *>(msg->Body())->ins_id();
+  }
+
+  if (!ins_id) {
+    return 0;
+  }
+
+  auto iter = instrument_channels.find(ins_id->str());
+  return iter != end(instrument_channels) ? iter->second : 0;
+}
+
+// --
+void pollloop(std::chrono::microseconds spin_budget) {
+  typedef std::chrono::steady_clock clock;
+
+  static distribution parks("msg_poll_parked_us");
+  bool spin_forever = spin_budget == std::chrono::microseconds::max();
+  auto last_active = clock::now();
+
+  while (running) {
+    size_t received = 0;
+    for (auto &channel : channels) {
+      received += channel->poll();
+    }
+
+    // Timers, flushes and anything else registered on the base
+    event_base_loop(base, EVLOOP_NONBLOCK);
+
+    if (spin_forever) {
+      continue;
+    }
+
+    auto now = clock::now();
+    if (received > 0) {
+      last_active = now;
+    }
+    else if (running && now - last_active > spin_budget) {
+      event_base_loop(base, EVLOOP_ONCE);
+
+      last_active = clock::now();
+      parks.collect(std::chrono::duration_cast<std::chrono::microseconds>(last_active - now).count());
+    }
+  }
+}
+
 // --
 void on_read(const void *data, size_t size) {
   static stream_measure measure("msg_rx");
   measure.collect(size);
 
-  std::lock_guard<std::mutex> lock(cb_mutex);
-
-  for (auto &cb : callbacks) {
+  callbacks.for_each([=](messaging_callback_t *cb) {
     cb->received_message(data, size);
-  }
+  });
+
+  dispatchers.for_each([=](dispatcher *d) {
+    d->enqueue(data, size);
+  });
+}
+
+// --
+void on_credit() {
+  credit_callbacks.for_each([](const std::pair<messaging_credit_callback_t *, void *> &cb) {
+    cb.first->credit_available(cb.second);
+  });
 }
@@ -1,28 +1,92 @@
 #include "multicast_connection.h"
 #include "utils/variables.h"
 #include "utils/timing.h"
+#include "utils/memory.h"
 
 #include <glog/logging.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <unistd.h>
+#include <cstring>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <chrono>
 #include <ratio>
+#include <limits>
 
 #include "api/apidef_generated.h"
 
 #define MAX_BUFFER_SIZE 10000
+#define DEFAULT_MTU     1500
+#define IP_UDP_OVERHEAD 28
 
 // --
 static void readcb(evutil_socket_t sock, short events, void *opaque);
 static void writecb(evutil_socket_t sock, short events, void *opaque);
 
 // --
-typedef struct multicast_header {
-  uint64_t seq_num;
+// Wire format v2: one header per datagram followed by count messages, each
+// prefixed by its 16 bit size. Message i carries seq num base_seq_num + i.
+// v1 had a 12 byte header per message and no version; its first word is the
+// low half of a seq num, which won't match the magic.
+#define MULTICAST_MAGIC        0x4d4d5700 /* 'MMW' + version byte */
+#define MULTICAST_WIRE_VERSION 2
+
+typedef struct datagram_header {
+  uint32_t magic;
   uint16_t seq_id;
-  uint16_t size;
-} multicast_header_t;
+  uint16_t count;
+  uint64_t base_seq_num;
+} datagram_header_t;
+
+typedef uint16_t message_size_t;
+
+// --
+// MTU of MSG_INTERFACE, or of the first multicast capable non-loopback
+// interface that is up.
+static int interface_mtu() {
+  std::string name = read_variable<std::string>("MSG_INTERFACE", "");
+
+  if (name.empty()) {
+    struct ifaddrs *addrs = nullptr;
+    if (getifaddrs(&addrs) == 0) {
+      for (struct ifaddrs *ifa = addrs; ifa; ifa = ifa->ifa_next) {
+        int flags = ifa->ifa_flags;
+        if ((flags & IFF_UP) && (flags & IFF_MULTICAST) && !(flags & IFF_LOOPBACK)) {
+          name = ifa->ifa_name;
+          break;
+        }
+      }
+
+      freeifaddrs(addrs);
+    }
+  }
+
+  if (name.empty()) {
+    return DEFAULT_MTU;
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+
+  int mtu = DEFAULT_MTU;
+  if (sock >= 0 && ioctl(sock, SIOCGIFMTU, &ifr) == 0) {
+    mtu = ifr.ifr_mtu;
+  }
+  else {
+    LOG(WARNING) << "Failed to read MTU of " << name << ", assuming " << DEFAULT_MTU;
+  }
+
+  if (sock >= 0) {
+    close(sock);
+  }
+
+  return mtu;
+}
 
 // --
 multicast_connection::multicast_connection(const char *group_address, uint16_t port) {
@@ -39,6 +103,64 @@ multicast_connection::multicast_connection(const char *group_address, uint16_t p
   local_addr.sin_port = htons(port);
 
   sync_send = read_variable<bool>("MSG_SYNC_SEND", true);
+  tx_window = read_variable<uint64_t>("MSG_TX_WINDOW", 16);
+  batch_target_size = read_variable<size_t>("MSG_BATCH_TARGET_SIZE", 1400);
+  tx_queue_limit = read_variable<size_t>("MSG_TX_QUEUE_LIMIT", 1 << 20);
+
+  measure_wakeup = read_variable<bool>("MSG_RX_LATENCY", false);
+  use_uring = read_variable<std::string>("MSG_IO_ENGINE", "libevent") == "uring";
+  if (use_uring && !uring_engine::available()) {
+    LOG(WARNING) << "Built without io_uring support, using libevent";
+    use_uring = false;
+  }
+
+  if (tx_window == 0) {
+    LOG(WARNING) << "Tx window can't be empty, using 1";
+    tx_window = 1;
+  }
+
+  max_batch_delay = std::chrono::microseconds(read_variable<int>("MSG_BATCH_MAX_DELAY_US", 50));
+  window_timeout = std::chrono::microseconds(read_variable<int>("MSG_TX_WINDOW_TIMEOUT_US", 10000));
+
+  // Datagrams above the path MTU get IP fragmented; losing one fragment loses the batch
+  max_datagram_size = read_variable<size_t>("MSG_MAX_DATAGRAM_SIZE", 0);
+  if (max_datagram_size == 0) {
+    max_datagram_size = interface_mtu() - IP_UDP_OVERHEAD;
+  }
+
+  if (max_datagram_size > MAX_BUFFER_SIZE) {
+    max_datagram_size = MAX_BUFFER_SIZE;
+  }
+
+  if (batch_target_size > max_datagram_size) {
+    LOG(WARNING) << "Capping batch target size to " << max_datagram_size;
+    batch_target_size = max_datagram_size;
+  }
+
+  LOG(INFO) << "Max datagram size " << max_datagram_size << ", batch target " << batch_target_size;
+
+  std::string capture_file = read_variable<std::string>("MSG_CAPTURE_FILE", "");
+  if (!capture_file.empty()) {
+    capture = capture_writer::open(capture_file);
+  }
+
+  fault_config_t rx_config = fault_config::from_variables("MSG_FAULT_RX_");
+  if (rx_config.enabled()) {
+    rx_faults = make_unique<fault_injector>(rx_config, [this](char *buffer, size_t size) {
+      process_datagram(buffer, size);
+    });
+  }
+
+  fault_config_t tx_config = fault_config::from_variables("MSG_FAULT_TX_");
+  if (tx_config.enabled()) {
+    if (sync_send && tx_config.drop_rate > 0.0) {
+      LOG(WARNING) << "Dropping on send with sync send stalls once a window's worth is lost";
+    }
+
+    tx_faults = make_unique<fault_injector>(tx_config, [this](char *buffer, size_t size) {
+      transmit_message(buffer, size);
+    });
+  }
 }
 
 // --
@@ -78,24 +200,73 @@ void multicast_connection::join(struct event_base *read_base, struct event_base
       std::abort();
     }
 
+#ifdef IP_MULTICAST_ALL
+    // Only deliver the group joined on this socket, not every group on the port
+    int all = 0;
+    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all)) < 0) {
+      LOG(ERROR) << "Failed to clear IP_MULTICAST_ALL: " << strerror(errno);
+      std::abort();
+    }
+#endif
+
+    // Lets recv spin in the driver instead of waiting for the interrupt
+    int busy_poll = read_variable<int>("MSG_BUSY_POLL_US", 0);
+    if (busy_poll > 0 && setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0) {
+      LOG(WARNING) << "Failed to set SO_BUSY_POLL (needs CAP_NET_ADMIN): " << strerror(errno);
+    }
+
+    int timestamps = 1;
+    if (measure_wakeup && setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps, sizeof(timestamps)) < 0) {
+      LOG(WARNING) << "Failed to enable receive timestamps: " << strerror(errno);
+      measure_wakeup = false;
+    }
+
     // Join the event loop
-    read_event = event_new(read_base, sock, EV_READ|EV_PERSIST, ::readcb, this);
-    if (!read_event) {
-      LOG(ERROR) << "Failed to create read event";
+    if (!use_uring) {
+      read_event = event_new(read_base, sock, EV_READ|EV_PERSIST, ::readcb, this);
+      if (!read_event) {
+        LOG(ERROR) << "Failed to create read event";
+        std::abort();
+      }
+
+      event_add(read_event, nullptr);
+    }
+  }
+  else if (sync_send) {
+    LOG(INFO) << "Not reading from group, disabling sync send";
+    sync_send = false;
+  }
+
+  if (use_uring) {
+    // The ring is single issuer: reads and buffered writes share one loop
+    if (read_base && write_base && read_base != write_base) {
+      LOG(ERROR) << "io_uring engine needs reads and writes on the same event base";
       std::abort();
     }
 
-    event_add(read_event, nullptr);
+    uring = make_unique<uring_engine>(sock, read_variable<bool>("MSG_URING_SQPOLL", false));
+    uring->on_datagram = [this](char *buffer, size_t size) {
+      receive_datagram(buffer, size);
+    };
+
+    uring->join(read_base ? read_base : write_base, read_base != nullptr);
   }
 
   if (write_base) {
-    write_event = event_new(write_base, sock, EV_WRITE|EV_PERSIST, ::writecb, this);
+    // Not bound to socket writability; activated by queue depth or armed as a timer
+    write_event = event_new(write_base, -1, 0, ::writecb, this);
     if (!write_event) {
       LOG(ERROR) << "Failed to create write event";
       std::abort();
     }
+  }
+
+  if (rx_faults && read_base) {
+    rx_faults->join(read_base);
+  }
 
-    event_add(write_event, nullptr);
+  if (tx_faults && (write_base || read_base)) {
+    tx_faults->join(write_base ? write_base : read_base);
   }
 }
 
@@ -106,6 +277,7 @@ void multicast_connection::leave() {
     return;
   }
 
+  uring.reset();
   evutil_closesocket(sock);
 
   if (read_event) {
@@ -121,122 +293,358 @@ void multicast_connection::leave() {
 
 // --
 void multicast_connection::readcb(evutil_socket_t sock, short events) {
+  read_datagram();
+}
+
+// --
+size_t multicast_connection::poll() {
+  // The io_uring engine owns the receive side, it's driven by the event loop
+  if (!read_event) {
+    return 0;
+  }
+
+  size_t count = 0;
+  while (read_datagram()) {
+    count++;
+  }
+
+  return count;
+}
+
+// --
+bool multicast_connection::read_datagram() {
+  static distribution wakeups("msg_rx_wakeup_ns");
+
   char buffer[MAX_BUFFER_SIZE];
-  struct sockaddr_in src_addr;
-  socklen_t len;
+  char control[CMSG_SPACE(sizeof(struct timespec))];
+
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof(buffer);
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (measure_wakeup) {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+  }
+
+  ssize_t size = recvmsg(sock, &msg, MSG_DONTWAIT);
+  if (size < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      LOG(ERROR) << "Failure during read: " << strerror(errno);
+    }
+
+    return false;
+  }
+
+  if (measure_wakeup) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+        struct timespec received, now;
+        memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        wakeups.collect((now.tv_sec - received.tv_sec) * 1000000000 + (now.tv_nsec - received.tv_nsec));
+      }
+    }
+  }
+
+  receive_datagram(buffer, size);
+  return true;
+}
 
-  int remaining_bytes = recvfrom(sock, buffer, sizeof(buffer), 0, reinterpret_cast<struct sockaddr *>(&src_addr), &len);
+// --
+void multicast_connection::receive_datagram(char *buffer, size_t size) {
+  if (capture) {
+    capture->append(remote_addr, buffer, size);
+  }
 
-  if (remaining_bytes <= sizeof(multicast_header_t)) {
+  inject(buffer, size);
+}
+
+// --
+void multicast_connection::inject(char *buffer, size_t size) {
+  if (rx_faults) {
+    rx_faults->inject(buffer, size);
+  }
+  else {
+    process_datagram(buffer, size);
+  }
+}
+
+// --
+void multicast_connection::process_datagram(char *buffer, size_t size) {
+  if (size < sizeof(datagram_header_t)) {
     LOG(ERROR) << "Failure during read: not enough bytes";
     return;
   }
 
-  char *cursor = buffer;
+  // NOTE: expecting host endian for header fields
+  const datagram_header_t *hdr = reinterpret_cast<const datagram_header_t *>(buffer);
 
-  while (remaining_bytes > 0) {
-    // NOTE: expecting host endian for header fields
-    multicast_header_t *hdr = reinterpret_cast<multicast_header_t *>(cursor);
-    uint64_t seq_num = hdr->seq_num;
-    uint16_t seq_id = hdr->seq_id;
+  if ((hdr->magic & 0xffffff00) != MULTICAST_MAGIC) {
+    LOG_EVERY_N(WARNING, 1000) << "Dropping datagram without wire header, old node on the group?";
+    return;
+  }
+  else if ((hdr->magic & 0xff) != MULTICAST_WIRE_VERSION) {
+    LOG_EVERY_N(WARNING, 1000) << "Dropping datagram with wire version " << (hdr->magic & 0xff)
+                               << ", expected " << MULTICAST_WIRE_VERSION;
+    return;
+  }
 
-    if (seq_id == sequences.local_id()) {
-      if (seq_num == in_flight_seq_num) {
-        in_flight_seq_num = 0;
-      }
+  uint16_t seq_id = hdr->seq_id;
+  uint64_t first_seq_num = hdr->base_seq_num;
+  uint64_t last_seq_num = first_seq_num + hdr->count - 1;
+
+  if (hdr->count == 0) {
+    return;
+  }
 
-      last_rx_seq_num = seq_num;
+  if (seq_id == sequences.local_id()) {
+    bool window_full = window_credit() == 0;
+    last_rx_seq_num = last_seq_num;
+
+    // Whatever queued up while the window was full can go out now
+    if (sync_send && window_full && write_event) {
+      event_active(write_event, EV_TIMEOUT, 0);
     }
+  }
 
-    remaining_bytes -= sizeof(multicast_header_t) + hdr->size;
-    int seq_diff = sequences.check(seq_id, seq_num);
+  // Sequencing is checked once for the whole datagram
+  int seq_diff = sequences.check(seq_id, first_seq_num);
+  uint64_t skip = 0;
 
-    if (seq_diff <= 0) {
-      LOG(WARNING) << "Detected duplicate seq_id=" << seq_id << ", seq_num=" << seq_num;
-      continue;
+  if (seq_diff <= 0) {
+    if (sequences.check(seq_id, last_seq_num) <= 0) {
+      LOG(WARNING) << "Detected duplicate seq_id=" << seq_id << ", seq_num=" << first_seq_num << "-" << last_seq_num;
+      return;
     }
-    else if (seq_diff > 1) {
-      LOG(WARNING) << "Detected gap, seq_id=" << seq_id << ", seq_num=" << seq_num << ", seq_diff=" << seq_diff;
-      continue;
+
+    // Overlaps what we've already delivered; skip that part
+    skip = 1 - seq_diff;
+  }
+  else if (seq_diff > 1) {
+    static distribution gaps("msg_rx_gap_messages");
+    gaps.collect(seq_diff - 1);
+
+    LOG(WARNING) << "Detected gap, seq_id=" << seq_id << ", seq_num=" << first_seq_num << ", seq_diff=" << seq_diff;
+  }
+
+  char *cursor = buffer + sizeof(datagram_header_t);
+  char *end = buffer + size;
+
+  for (uint64_t i = 0; i < hdr->count; ++i) {
+    if (end - cursor < static_cast<ptrdiff_t>(sizeof(message_size_t))) {
+      LOG(ERROR) << "Truncated datagram from seq_id=" << seq_id;
+      break;
     }
 
-    void *data = cursor + sizeof(multicast_header_t);
-    size_t size = hdr->size;
+    message_size_t msg_size;
+    memcpy(&msg_size, cursor, sizeof(msg_size));
+    cursor += sizeof(message_size_t);
 
-    if (on_read) {
-      on_read(data, size);
+    if (end - cursor < msg_size) {
+      LOG(ERROR) << "Truncated datagram from seq_id=" << seq_id;
+      break;
     }
 
-    cursor += sizeof(multicast_header_t) + hdr->size;
-    sequences.commit(seq_id, seq_num);
+    if (i >= skip) {
+      if (on_read) {
+        on_read(cursor, msg_size);
+      }
+
+      sequences.commit(seq_id, first_seq_num + i);
+    }
+
+    cursor += msg_size;
   }
 }
 
 // --
-void multicast_connection::writecb(evutil_socket_t sock, short events) {
-  std::lock_guard<std::mutex> lock(tx_queue_m);
-  if (tx_queue.empty() || (sync_send && in_flight_seq_num != 0)) {
-    return;
-  }
-
+void multicast_connection::writecb(evutil_socket_t, short events) {
+  static distribution batch_sizes("msg_tx_batch_bytes");
+  static distribution queue_delays("msg_tx_queue_delay_us");
   static char mtu[MAX_BUFFER_SIZE];
-  int space_remaining = MAX_BUFFER_SIZE;
-  char *cursor = mtu;
-  uint16_t seq_id = sequences.local_id();
-  uint64_t last_seq_num = 0;
+
+  std::unique_lock<std::mutex> lock(tx_queue_m);
 
   while (!tx_queue.empty()) {
-    auto item = tx_queue.front();
-    size_t total_size = item.size() + sizeof(multicast_header_t);
+    uint64_t credit = sync_send ? window_credit() : std::numeric_limits<uint64_t>::max();
+    auto now = clock::now();
+
+    if (credit == 0) {
+      // readcb reactivates us once our datagrams start looping back, unless
+      // they were lost; then the timer gives up on them
+      if (window_full_since == clock::time_point()) {
+        window_full_since = now;
+        schedule_flush(now + window_timeout);
+        break;
+      }
+
+      if (now - window_full_since < window_timeout) {
+        schedule_flush(window_full_since + window_timeout);
+        break;
+      }
+
+      expire_window();
+      credit = window_credit();
+    }
 
-    if (space_remaining < total_size) {
+    window_full_since = clock::time_point();
+    if (tx_queue_bytes < batch_target_size && now - tx_queue.front().enqueued < max_batch_delay) {
+      schedule_flush(tx_queue.front().enqueued + max_batch_delay);
       break;
     }
 
-    last_seq_num = sequences.alloc();
+    datagram_header_t *header = reinterpret_cast<datagram_header_t *>(mtu);
+    header->magic = MULTICAST_MAGIC | MULTICAST_WIRE_VERSION;
+    header->seq_id = sequences.local_id();
+    header->count = 0;
+    header->base_seq_num = 0;
+
+    char *cursor = mtu + sizeof(datagram_header_t);
+    size_t space_remaining = max_datagram_size - sizeof(datagram_header_t);
+    uint64_t last_seq_num = 0;
+
+    while (!tx_queue.empty()) {
+      const tx_item &item = tx_queue.front();
+      size_t total_size = item.data.size() + sizeof(message_size_t);
+
+      // Always take at least one message, then stop at the target size
+      if (header->count > 0 && (cursor - mtu) + total_size > batch_target_size) {
+        break;
+      }
+
+      if (space_remaining < total_size || credit == 0 || header->count == UINT16_MAX) {
+        break;
+      }
+
+      --credit;
+      last_seq_num = sequences.alloc();
+
+      if (header->count++ == 0) {
+        header->base_seq_num = last_seq_num;
+      }
+
+      message_size_t msg_size = item.data.size();
+      memcpy(cursor, &msg_size, sizeof(msg_size));
+      cursor += sizeof(message_size_t);
+      memcpy(cursor, item.data.data(), item.data.size());
+      cursor += item.data.size();
+
+      queue_delays.collect(std::chrono::duration_cast<std::chrono::microseconds>(now - item.enqueued).count());
+
+      tx_queue_bytes -= total_size;
+      space_remaining -= total_size;
+      tx_queue.pop();
+    }
+
+    if (tx_faults) {
+      tx_faults->inject(mtu, cursor - mtu);
+    }
+    else if (uring) {
+      uring->send(mtu, cursor - mtu, remote_addr);
+    }
+    else {
+      transmit_message(mtu, cursor - mtu);
+    }
+
+    sequences.commit(last_seq_num);
+    batch_sizes.collect(cursor - mtu);
+    last_tx_seq_num = last_seq_num;
+  }
+
+  if (uring) {
+    // One submission for every datagram packed in this round
+    uring->submit();
+  }
 
-    multicast_header_t *header = reinterpret_cast<multicast_header_t *>(cursor);
-    header->seq_num = last_seq_num;
-    header->seq_id = seq_id;
-    header->size = item.size();
+  bool credit_returned = tx_queue_blocked && tx_queue_bytes <= tx_queue_limit / 2;
+  if (credit_returned) {
+    tx_queue_blocked = false;
+  }
 
-    cursor += sizeof(multicast_header_t);
-    memcpy(cursor, item.data(), item.size());
-    cursor += item.size();
+  lock.unlock();
 
-    tx_queue.pop();
-    space_remaining -= total_size;
+  if (credit_returned && on_credit) {
+    on_credit();
   }
+}
+
+// --
+void multicast_connection::schedule_flush(clock::time_point due) {
+  auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(due - clock::now());
+  long usec = std::max<long>(remaining.count(), 0);
+
+  struct timeval tv;
+  tv.tv_sec = usec / 1000000;
+  tv.tv_usec = usec % 1000000;
+  event_add(write_event, &tv);
+}
 
-  transmit_message(mtu, cursor - mtu);
-  sequences.commit(last_seq_num);
+// --
+uint64_t multicast_connection::window_credit() const {
+  uint64_t in_flight = last_tx_seq_num - last_rx_seq_num;
+  return in_flight >= tx_window ? 0 : tx_window - in_flight;
+}
+
+// --
+void multicast_connection::expire_window() {
+  static distribution lost("msg_tx_window_expired");
+
+  uint64_t tx = last_tx_seq_num, rx = last_rx_seq_num;
+  lost.collect(tx - rx);
+
+  LOG_EVERY_N(WARNING, 100) << "Own datagrams didn't loop back within "
+                            << std::chrono::duration_cast<std::chrono::microseconds>(window_timeout).count() << "us, "
+                            << "assuming seq_num " << rx + 1 << "-" << tx << " lost";
+  last_rx_seq_num = tx;
 }
 
 // --
 uint64_t multicast_connection::send_now(const void *data, size_t size, int flags) {
-  if (size > MAX_BUFFER_SIZE - sizeof(multicast_header_t)) {
-    LOG(ERROR) << "Buffer overrun";
-    std::abort();
+  const size_t overhead = sizeof(datagram_header_t) + sizeof(message_size_t);
+
+  if (size > max_message_size()) {
+    LOG(ERROR) << "Message of " << size << " bytes exceeds datagram size " << max_datagram_size;
+    return 0;
   }
 
   char buffer[MAX_BUFFER_SIZE];
-  multicast_header_t *hdr = reinterpret_cast<multicast_header_t *>(buffer);
+  datagram_header_t *hdr = reinterpret_cast<datagram_header_t *>(buffer);
   uint64_t new_seq = sequences.alloc();
-  hdr->seq_num = new_seq;
+  hdr->magic = MULTICAST_MAGIC | MULTICAST_WIRE_VERSION;
   hdr->seq_id = sequences.local_id();
-  hdr->size = size;
+  hdr->count = 1;
+  hdr->base_seq_num = new_seq;
 
-  memcpy(buffer + sizeof(multicast_header_t), data, size);
+  message_size_t msg_size = size;
+  memcpy(buffer + sizeof(datagram_header_t), &msg_size, sizeof(msg_size));
+  memcpy(buffer + overhead, data, size);
 
-  transmit_message(buffer, size + sizeof(multicast_header_t));
-
-  if (flags & SEND_SYNC) {
-    while (last_rx_seq_num != new_seq);
+  if (tx_faults) {
+    tx_faults->inject(buffer, size + overhead);
+  }
+  else {
+    transmit_message(buffer, size + overhead);
   }
-
   sequences.commit(new_seq);
   last_tx_seq_num = new_seq;
 
+  if (flags & SEND_SYNC) {
+    // Pipelined: only block once the window of unconfirmed seq nums is full
+    auto deadline = clock::now() + window_timeout;
+    while (window_credit() == 0) {
+      if (clock::now() >= deadline) {
+        expire_window();
+      }
+    }
+  }
+
   return new_seq;
 }
 
@@ -263,17 +671,57 @@ void multicast_connection::transmit_message(const void *data, size_t size) {
 
 
 // --
-void multicast_connection::send(const void *data, size_t size) {
+size_t multicast_connection::max_message_size() const {
+  return max_datagram_size - sizeof(datagram_header_t) - sizeof(message_size_t);
+}
+
+// --
+status_t multicast_connection::send(const void *data, size_t size) {
+  if (size > max_message_size()) {
+    // Would have to be fragmented; refuse rather than stall the tx queue
+    return ERR_MSGSIZE;
+  }
+
   if (write_event) {
+    size_t total_size = size + sizeof(message_size_t);
     const char *ptr = reinterpret_cast<const char *>(data);
-    std::vector<char> v(ptr, ptr + size);
 
     std::lock_guard<std::mutex> lock(tx_queue_m);
-    tx_queue.emplace(v);
+    if (tx_queue_bytes + total_size > tx_queue_limit) {
+      tx_queue_blocked = true;
+      return ERR_TXFULL;
+    }
+
+    bool was_empty = tx_queue.empty();
+    size_t prev_bytes = tx_queue_bytes;
+
+    tx_queue_bytes += total_size;
+    tx_queue.push({std::vector<char>(ptr, ptr + size), clock::now()});
+
+    if (prev_bytes < batch_target_size && tx_queue_bytes >= batch_target_size) {
+      event_active(write_event, EV_WRITE, 0);
+    }
+    else if (was_empty) {
+      schedule_flush(tx_queue.front().enqueued + max_batch_delay);
+    }
   }
   else {
     send_now(data, size, sync_send ? SEND_SYNC : 0);
   }
+
+  return SUC_OK;
+}
+
+// --
+size_t multicast_connection::credit() {
+  if (!write_event) {
+    // send_now blocks the caller instead
+    return std::numeric_limits<size_t>::max();
+  }
+
+  std::lock_guard<std::mutex> lock(tx_queue_m);
+  size_t used = tx_queue_bytes + sizeof(message_size_t);
+  return used >= tx_queue_limit ? 0 : tx_queue_limit - used;
 }
 
 // --
@@ -5,7 +5,9 @@
 
 #include <cstdint>
 #include <atomic>
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <vector>
@@ -14,6 +16,10 @@
 #include <event2/event.h>
 
 #include "sequence.h"
+#include "framework/services.h"
+#include "uring_engine.h"
+#include "fault_injector.h"
+#include "capture.h"
 
 #define SEND_SYNC 0x0001
 
@@ -29,17 +35,44 @@ public:
   void join(struct event_base *read_base, struct event_base *write_base);
   void leave();
 
-  // Thread safe
+  // Thread safe. send refuses messages that don't fit in a datagram
+  // (ERR_MSGSIZE) and messages beyond the tx queue limit (ERR_TXFULL).
   uint64_t send_now(const void *data, size_t size, int flags);
-  void send(const void *data, size_t size);
+  status_t send(const void *data, size_t size);
+  size_t credit();
+  size_t max_message_size() const;
 
   std::function<void(const void *, size_t)> on_read;
 
+  // Handles a datagram as if it had been received, e.g. from a capture.
+  // Call from the read side only.
+  void inject(char *buffer, size_t size);
+
+  // Called from the writer once a full tx queue has drained to half
+  std::function<void()> on_credit;
+
+  // Reads whatever is queued on the socket without blocking, for busy
+  // polling from the read side. Returns the number of datagrams handled.
+  size_t poll();
+
   void readcb(evutil_socket_t sock, short events);
   void writecb(evutil_socket_t sock, short events);
 
 private:
+  typedef std::chrono::high_resolution_clock clock;
+
+  struct tx_item {
+    std::vector<char> data;
+    clock::time_point enqueued;
+  };
+
+  bool read_datagram();
+  void receive_datagram(char *buffer, size_t size);
+  void process_datagram(char *buffer, size_t size);
   void transmit_message(const void *data, size_t size);
+  void schedule_flush(clock::time_point due);
+  uint64_t window_credit() const;
+  void expire_window();
 
   struct sockaddr_in remote_addr;
   struct sockaddr_in local_addr;
@@ -48,18 +81,43 @@ private:
   struct event *write_event = nullptr;
   evutil_socket_t sock;
 
-  std::mutex tx_queue_m;
-  std::queue<std::vector<char>> tx_queue;
+  // Optional io_uring engine replacing read_event and sendto in writecb
+  bool use_uring;
+  std::unique_ptr<uring_engine> uring;
+
+  // MSG_RX_LATENCY: kernel receive timestamp to delivery, msg_rx_wakeup_ns
+  bool measure_wakeup;
 
-  uint64_t in_flight_seq_num;
+  // Loss/duplication/delay for tests and benchmarks, MSG_FAULT_RX_* and MSG_FAULT_TX_*
+  std::unique_ptr<fault_injector> rx_faults;
+  std::unique_ptr<fault_injector> tx_faults;
 
+  // Everything that arrives is appended here with MSG_CAPTURE_FILE
+  std::shared_ptr<capture_writer> capture;
+
+  // Buffered mode flushes when tx_queue_bytes reaches batch_target_size or
+  // when the oldest queued message has waited max_batch_delay.
+  std::mutex tx_queue_m;
+  std::queue<tx_item> tx_queue;
+  size_t tx_queue_bytes = 0;
+  size_t tx_queue_limit;
+  bool tx_queue_blocked = false;
+  size_t batch_target_size;
+  size_t max_datagram_size;
+  clock::duration max_batch_delay;
+
+  // With sync send, at most tx_window of our own seq nums may be sent but
+  // not yet looped back to us. Without retransmission a lost datagram would
+  // hold the window shut, so it's reopened after window_timeout.
   bool sync_send;
+  uint64_t tx_window;
+  clock::duration window_timeout;
+  clock::time_point window_full_since;
 
   sequence_numbers sequences;
 
-  // Used in non-buffered mode
-  std::atomic<uint64_t> last_tx_seq_num;
-  alignas(64) std::atomic<uint64_t> last_rx_seq_num;
+  std::atomic<uint64_t> last_tx_seq_num{0};
+  alignas(64) std::atomic<uint64_t> last_rx_seq_num{0};
 };
 
 #endif // !_MESSAGING_MULTICAST_CONNECTION_H
@@ -1,65 +1,22 @@
 #include "sequence.h"
-#include "utils/variables.h"
+#include "id_source.h"
 
-#include <hiredis/hiredis.h>
 #include <glog/logging.h>
 #include <cassert>
-#include <limits>
 
 // --
-sequence_numbers::sequence_numbers() {
-  redisContext *ctx = redisConnect(read_variable<const char *>("MSG_ID_SOURCE_ADDR", "127.0.0.1"), read_variable("MSG_ID_SOURCE_PORT", 6379));
-
-  if (!ctx || ctx->err) {
-    if (ctx) {
-      LOG(ERROR) << "Failed to create Redis context: " << ctx->err;
-    }
-    else {
-      LOG(ERROR) << "Failed to allocate Redis context";
-    }
-
-    std::abort();
-  }
-
-  redisReply *reply = reinterpret_cast<redisReply *>(redisCommand(ctx, "INCR msg_seq_id"));
-  if (!reply) {
-    LOG(ERROR) << "Failed to send Redis command: " << ctx->err;
-    std::abort();
-  }
-
-  assert(reply->type == REDIS_REPLY_INTEGER && "returned data isn't an integer");
-  assert(reply->integer >= 0 && "returned id is negative");
-  assert(reply->integer < std::numeric_limits<uint16_t>::max());
-
-  await_consensus(ctx);
-
-  seq_id = reply->integer;
-  last_alloc_seq_num = 0;
-
-  LOG(INFO) << "Allocated id " << seq_id;
+sequence_numbers::sequence_numbers()
+  : sequence_numbers(allocate_seq_id())
+{
 }
 
 // --
-void sequence_numbers::await_consensus(void *context) {
-  redisContext *ctx = reinterpret_cast<redisContext *>(context);
-
-  int quorum = read_variable<int>("MSG_QUORUM", 0);
-  if (quorum == 0) {
-    return;
-  }
-
-  redisReply *reply = reinterpret_cast<redisReply *>(redisCommand(ctx, "WAIT %d 0", quorum));
-  if (!reply) {
-    LOG(ERROR) << "Failed to send Redis command: " << ctx->err;
-    std::abort();
-  }
-
-  assert(reply->type == REDIS_REPLY_INTEGER && "returned data isn't an integer");
-
-  if (reply->integer != quorum) {
-    LOG(ERROR) << "Failed to reach consensus";
-    std::abort();
-  }
+sequence_numbers::sequence_numbers(uint16_t seq_id)
+  : seq_id(seq_id)
+  , last_alloc_seq_num(0)
+  , pending_seq_nums(0)
+{
+  LOG(INFO) << "Allocated id " << seq_id;
 }
 
 // --
@@ -9,6 +9,7 @@
 class sequence_numbers {
 public:
   sequence_numbers();
+  explicit sequence_numbers(uint16_t seq_id);
 
   uint64_t alloc();
   void     commit(uint64_t num);
@@ -19,8 +20,6 @@ public:
   int check(uint16_t seq_id, uint64_t seq_num) const;
 
 private:
-  void await_consensus(void *context);
-
   uint16_t seq_id;
   uint64_t last_alloc_seq_num;
   int pending_seq_nums;
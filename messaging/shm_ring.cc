@@ -0,0 +1,201 @@
+#include "shm_ring.h"
+
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
+#define SHM_RING_MAGIC   0x6d6d7267 /* 'mmrg' */
+#define SHM_RING_VERSION 1
+#define SHM_SLOT_SIZE    512
+
+#define STATE_EMPTY        0
+#define STATE_INITIALIZING 1
+#define STATE_READY        2
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared atomics must be lock free");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared atomics must be lock free");
+
+// --
+struct shm_ring::ring_header {
+  std::atomic<uint32_t> state;
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t slot_size;
+
+  alignas(64) std::atomic<uint64_t> head;
+};
+
+// --
+// stamp is 2*pos+1 while a publisher writes ring position pos, 2*pos+2 when
+// it's done. Readers copy the slot and re-check the stamp (seqlock style).
+struct shm_ring::slot_header {
+  std::atomic<uint64_t> stamp;
+  uint64_t seq_num;
+  uint16_t seq_id;
+  uint16_t size;
+};
+
+const size_t shm_ring::MAX_PAYLOAD_SIZE = SHM_SLOT_SIZE - sizeof(shm_ring::slot_header);
+
+// --
+shm_ring::shm_ring(const char *name, uint32_t slot_count) {
+  if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0) {
+    LOG(ERROR) << "Slot count must be a power of two: " << slot_count;
+    std::abort();
+  }
+
+  int fd = shm_open(name, O_CREAT|O_RDWR, 0666);
+  if (fd < 0) {
+    LOG(ERROR) << "Failed to open shared memory " << name << ": " << strerror(errno);
+    std::abort();
+  }
+
+  size_t ring_size = sizeof(ring_header) + static_cast<size_t>(slot_count) * SHM_SLOT_SIZE;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR) << "Failed to stat shared memory: " << strerror(errno);
+    std::abort();
+  }
+
+  if (st.st_size == 0 && ftruncate(fd, ring_size) < 0) {
+    LOG(ERROR) << "Failed to size shared memory: " << strerror(errno);
+    std::abort();
+  }
+  else if (st.st_size != 0 && static_cast<size_t>(st.st_size) != ring_size) {
+    LOG(ERROR) << "Shared memory " << name << " has size " << st.st_size << ", expected " << ring_size;
+    std::abort();
+  }
+
+  mapping_size = ring_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    LOG(ERROR) << "Failed to map shared memory: " << strerror(errno);
+    std::abort();
+  }
+
+  header = static_cast<ring_header *>(mapping);
+  slots = static_cast<char *>(mapping) + sizeof(ring_header);
+  slot_mask = slot_count - 1;
+
+  uint32_t state = STATE_EMPTY;
+  if (header->state.compare_exchange_strong(state, STATE_INITIALIZING)) {
+    header->magic = SHM_RING_MAGIC;
+    header->version = SHM_RING_VERSION;
+    header->slot_count = slot_count;
+    header->slot_size = SHM_SLOT_SIZE;
+    header->head.store(0);
+    header->state.store(STATE_READY, std::memory_order_release);
+    LOG(INFO) << "Created ring " << name << " with " << slot_count << " slots";
+  }
+  else {
+    while (header->state.load(std::memory_order_acquire) != STATE_READY);
+  }
+
+  if (header->magic != SHM_RING_MAGIC ||
+      header->version != SHM_RING_VERSION ||
+      header->slot_count != slot_count ||
+      header->slot_size != SHM_SLOT_SIZE) {
+    LOG(ERROR) << "Shared memory " << name << " isn't a compatible ring";
+    std::abort();
+  }
+
+  cursor = header->head.load(std::memory_order_acquire);
+}
+
+// --
+shm_ring::~shm_ring() {
+  munmap(mapping, mapping_size);
+}
+
+// --
+shm_ring::slot_header *shm_ring::slot_at(uint64_t pos) const {
+  return reinterpret_cast<slot_header *>(slots + (pos & slot_mask) * SHM_SLOT_SIZE);
+}
+
+// --
+bool shm_ring::send(const void *data, size_t size) {
+  if (size > MAX_PAYLOAD_SIZE) {
+    return false;
+  }
+
+  // Claiming the position under the lock keeps our own seq nums in ring order
+  std::lock_guard<std::mutex> lock(tx_m);
+  uint64_t seq_num = sequences.alloc();
+  uint64_t pos = header->head.fetch_add(1, std::memory_order_acq_rel);
+
+  slot_header *slot = slot_at(pos);
+  slot->stamp.store(2 * pos + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->seq_num = seq_num;
+  slot->seq_id = sequences.local_id();
+  slot->size = size;
+  memcpy(reinterpret_cast<char *>(slot + 1), data, size);
+
+  slot->stamp.store(2 * pos + 2, std::memory_order_release);
+  sequences.commit(seq_num);
+
+  return true;
+}
+
+// --
+int shm_ring::poll() {
+  char buffer[SHM_SLOT_SIZE];
+  int delivered = 0;
+
+  while (true) {
+    slot_header *slot = slot_at(cursor);
+    uint64_t expected = 2 * cursor + 2;
+    uint64_t stamp = slot->stamp.load(std::memory_order_acquire);
+
+    if (stamp < expected) {
+      // Not published yet (or still being written)
+      break;
+    }
+
+    uint64_t seq_num = slot->seq_num;
+    uint16_t seq_id = slot->seq_id;
+    uint16_t size = slot->size;
+
+    if (size <= MAX_PAYLOAD_SIZE) {
+      memcpy(buffer, reinterpret_cast<char *>(slot + 1), size);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (stamp != expected || slot->stamp.load(std::memory_order_relaxed) != stamp) {
+      uint64_t head = header->head.load(std::memory_order_acquire);
+      LOG(WARNING) << "Reader lapped at pos=" << cursor << ", skipping " << head - cursor << " messages";
+      cursor = head;
+      continue;
+    }
+
+    ++cursor;
+
+    int seq_diff = sequences.check(seq_id, seq_num);
+    if (seq_diff <= 0) {
+      LOG(WARNING) << "Detected duplicate seq_id=" << seq_id << ", seq_num=" << seq_num;
+      continue;
+    }
+    else if (seq_diff > 1) {
+      LOG(WARNING) << "Detected gap, seq_id=" << seq_id << ", seq_num=" << seq_num << ", seq_diff=" << seq_diff;
+    }
+
+    sequences.commit(seq_id, seq_num);
+
+    if (on_read) {
+      on_read(buffer, size);
+    }
+
+    ++delivered;
+  }
+
+  return delivered;
+}
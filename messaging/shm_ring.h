@@ -0,0 +1,53 @@
+// -*- c++ -*-
+
+#ifndef _MESSAGING_SHM_RING_H
+#define _MESSAGING_SHM_RING_H
+
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+#include "sequence.h"
+
+/*
+ * Same-host transport over a memory-mapped ring in /dev/shm.
+ * Any number of processes can publish into the ring; every instance is also
+ * a reader with its own cursor. Slow readers are lapped rather than blocking
+ * publishers, which shows up as a gap just like a dropped datagram would.
+ */
+class shm_ring {
+public:
+  shm_ring(const char *name, uint32_t slot_count);
+  ~shm_ring();
+
+  // Thread safe. Returns false if the message doesn't fit in a slot.
+  bool send(const void *data, size_t size);
+
+  // Delivers everything published since the last call, returns the count.
+  int poll();
+
+  std::function<void(const void *, size_t)> on_read;
+
+  static const size_t MAX_PAYLOAD_SIZE;
+
+private:
+  struct ring_header;
+  struct slot_header;
+
+  slot_header *slot_at(uint64_t pos) const;
+
+  void *mapping;
+  size_t mapping_size;
+
+  ring_header *header;
+  char *slots;
+  uint64_t slot_mask;
+
+  std::mutex tx_m;
+  sequence_numbers sequences;
+
+  uint64_t cursor;
+};
+
+#endif // !_MESSAGING_SHM_RING_H
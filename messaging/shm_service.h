@@ -0,0 +1,7 @@
+#ifndef _SHM_MESSAGING_INIT_H
+#define _SHM_MESSAGING_INIT_H
+
+extern "C" void shm_messaging_init();
+extern "C" void shm_messaging_shutdown();
+
+#endif // !_SHM_MESSAGING_INIT_H
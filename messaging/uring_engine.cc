@@ -0,0 +1,289 @@
+#include "uring_engine.h"
+#include "utils/timing.h"
+
+#include <glog/logging.h>
+#include <cstdlib>
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+
+#define URING_ENTRIES      256
+#define URING_BUF_GROUP    1
+#define URING_RECV_BUFS    256
+#define URING_RECV_BUF_LEN 10000
+#define URING_SEND_SLOTS   64
+#define URING_SEND_BUF_LEN 10000
+
+#define RECV_USER_DATA     0
+
+// --
+static void completecb(evutil_socket_t fd, short events, void *opaque);
+
+// --
+struct uring_engine::impl {
+  struct send_slot {
+    char buffer[URING_SEND_BUF_LEN];
+    struct sockaddr_in addr;
+    struct iovec iov;
+    struct msghdr msg;
+  };
+
+  struct io_uring ring;
+  struct io_uring_buf_ring *buf_ring = nullptr;
+  std::vector<char> recv_bufs;
+
+  std::vector<send_slot> send_slots;
+  std::vector<int> free_slots;
+  int pending_sends = 0;
+
+  evutil_socket_t sock;
+  int efd = -1;
+  struct event *complete_event = nullptr;
+};
+
+// --
+uring_engine::uring_engine(evutil_socket_t sock, bool sqpoll)
+  : d(new impl)
+{
+  d->sock = sock;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  if (sqpoll) {
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = 1000;
+  }
+
+  int ret = io_uring_queue_init_params(URING_ENTRIES, &d->ring, &params);
+  if (ret < 0) {
+    LOG(ERROR) << "Failed to setup io_uring: " << strerror(-ret);
+    std::abort();
+  }
+
+  d->efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (d->efd < 0 || io_uring_register_eventfd(&d->ring, d->efd) < 0) {
+    LOG(ERROR) << "Failed to register io_uring eventfd";
+    std::abort();
+  }
+
+  d->send_slots.resize(URING_SEND_SLOTS);
+  for (int i = URING_SEND_SLOTS - 1; i >= 0; --i) {
+    d->free_slots.push_back(i);
+  }
+
+  LOG(INFO) << "Using io_uring engine" << (sqpoll ? " with SQPOLL" : "");
+}
+
+// --
+uring_engine::~uring_engine() {
+  if (d->complete_event) {
+    event_free(d->complete_event);
+  }
+
+  if (d->buf_ring) {
+    io_uring_free_buf_ring(&d->ring, d->buf_ring, URING_RECV_BUFS, URING_BUF_GROUP);
+  }
+
+  io_uring_queue_exit(&d->ring);
+  close(d->efd);
+}
+
+// --
+bool uring_engine::available() {
+  return true;
+}
+
+// --
+static void arm_recv(struct io_uring *ring, evutil_socket_t sock) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+  if (!sqe) {
+    io_uring_submit(ring);
+    sqe = io_uring_get_sqe(ring);
+  }
+
+  io_uring_prep_recv_multishot(sqe, sock, nullptr, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+  io_uring_sqe_set_data64(sqe, RECV_USER_DATA);
+}
+
+// --
+void uring_engine::join(struct event_base *base, bool recv) {
+  d->complete_event = event_new(base, d->efd, EV_READ|EV_PERSIST, ::completecb, this);
+  if (!d->complete_event) {
+    LOG(ERROR) << "Failed to create io_uring completion event";
+    std::abort();
+  }
+
+  event_add(d->complete_event, nullptr);
+
+  if (!recv) {
+    return;
+  }
+
+  int ret = 0;
+  d->buf_ring = io_uring_setup_buf_ring(&d->ring, URING_RECV_BUFS, URING_BUF_GROUP, 0, &ret);
+  if (!d->buf_ring) {
+    LOG(ERROR) << "Failed to register buffer ring: " << strerror(-ret);
+    std::abort();
+  }
+
+  d->recv_bufs.resize(URING_RECV_BUFS * URING_RECV_BUF_LEN);
+  int mask = io_uring_buf_ring_mask(URING_RECV_BUFS);
+
+  for (int i = 0; i < URING_RECV_BUFS; ++i) {
+    io_uring_buf_ring_add(d->buf_ring, &d->recv_bufs[i * URING_RECV_BUF_LEN], URING_RECV_BUF_LEN, i, mask, i);
+  }
+
+  io_uring_buf_ring_advance(d->buf_ring, URING_RECV_BUFS);
+
+  arm_recv(&d->ring, d->sock);
+  io_uring_submit(&d->ring);
+}
+
+// --
+void uring_engine::send(const void *data, size_t size, const struct sockaddr_in &addr) {
+  if (size > URING_SEND_BUF_LEN) {
+    LOG(ERROR) << "Buffer overrun";
+    std::abort();
+  }
+
+  if (d->free_slots.empty()) {
+    // Every slot is in flight; wait for the kernel to hand one back
+    submit();
+    io_uring_submit_and_wait(&d->ring, 1);
+    completecb();
+  }
+
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&d->ring);
+  if (!sqe) {
+    submit();
+    sqe = io_uring_get_sqe(&d->ring);
+  }
+
+  int idx = d->free_slots.back();
+  d->free_slots.pop_back();
+
+  impl::send_slot &slot = d->send_slots[idx];
+  memcpy(slot.buffer, data, size);
+  slot.addr = addr;
+  slot.iov.iov_base = slot.buffer;
+  slot.iov.iov_len = size;
+  memset(&slot.msg, 0, sizeof(slot.msg));
+  slot.msg.msg_name = &slot.addr;
+  slot.msg.msg_namelen = sizeof(slot.addr);
+  slot.msg.msg_iov = &slot.iov;
+  slot.msg.msg_iovlen = 1;
+
+  io_uring_prep_sendmsg(sqe, d->sock, &slot.msg, 0);
+  io_uring_sqe_set_data64(sqe, idx + 1);
+  d->pending_sends++;
+}
+
+// --
+void uring_engine::submit() {
+  static distribution sends_per_submit("uring_sends_per_submit");
+
+  if (d->pending_sends == 0) {
+    return;
+  }
+
+  sends_per_submit.collect(d->pending_sends);
+  d->pending_sends = 0;
+  io_uring_submit(&d->ring);
+}
+
+// --
+void uring_engine::completecb() {
+  static distribution cqes_per_wakeup("uring_cqes_per_wakeup");
+
+  eventfd_t value;
+  eventfd_read(d->efd, &value);
+
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  unsigned count = 0;
+  bool rearm = false;
+  int mask = io_uring_buf_ring_mask(URING_RECV_BUFS);
+
+  io_uring_for_each_cqe(&d->ring, head, cqe) {
+    ++count;
+    uint64_t user_data = io_uring_cqe_get_data64(cqe);
+
+    if (user_data != RECV_USER_DATA) {
+      if (cqe->res < 0) {
+        LOG(ERROR) << "Failed to send multicast message: " << strerror(-cqe->res);
+      }
+
+      d->free_slots.push_back(user_data - 1);
+      continue;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      rearm = true;
+    }
+
+    if (cqe->res < 0) {
+      if (cqe->res != -ENOBUFS) {
+        LOG(ERROR) << "Failure during read: " << strerror(-cqe->res);
+      }
+      continue;
+    }
+
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *buffer = &d->recv_bufs[bid * URING_RECV_BUF_LEN];
+
+    if (on_datagram) {
+      on_datagram(buffer, cqe->res);
+    }
+
+    io_uring_buf_ring_add(d->buf_ring, buffer, URING_RECV_BUF_LEN, bid, mask, 0);
+    io_uring_buf_ring_advance(d->buf_ring, 1);
+  }
+
+  io_uring_cq_advance(&d->ring, count);
+
+  if (count > 0) {
+    cqes_per_wakeup.collect(count);
+  }
+
+  if (rearm) {
+    arm_recv(&d->ring, d->sock);
+    io_uring_submit(&d->ring);
+  }
+}
+
+// --
+void completecb(evutil_socket_t fd, short events, void *opaque) {
+  static_cast<uring_engine *>(opaque)->completecb();
+}
+
+#else // !HAVE_LIBURING
+
+// --
+struct uring_engine::impl {};
+
+uring_engine::uring_engine(evutil_socket_t sock, bool sqpoll) {
+  LOG(ERROR) << "Built without liburing";
+  std::abort();
+}
+
+uring_engine::~uring_engine() {}
+
+bool uring_engine::available() {
+  return false;
+}
+
+void uring_engine::join(struct event_base *base, bool recv) {}
+void uring_engine::send(const void *data, size_t size, const struct sockaddr_in &addr) {}
+void uring_engine::submit() {}
+void uring_engine::completecb() {}
+
+#endif // HAVE_LIBURING
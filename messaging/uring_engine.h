@@ -0,0 +1,42 @@
+// -*- c++ -*-
+
+#ifndef _MESSAGING_URING_ENGINE_H
+#define _MESSAGING_URING_ENGINE_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <netinet/in.h>
+#include <event2/event.h>
+
+/*
+ * io_uring based I/O for a datagram socket, as an alternative to libevent
+ * readiness + recvfrom/sendto. Receives are a single multishot recv into a
+ * registered buffer ring, sends are queued and submitted in one batch.
+ * Completions are reaped when the ring's eventfd fires in the event loop,
+ * so everything runs on the thread dispatching that event base.
+ */
+class uring_engine {
+public:
+  uring_engine(evutil_socket_t sock, bool sqpoll);
+  ~uring_engine();
+
+  static bool available();
+
+  void join(struct event_base *base, bool recv);
+
+  // Copies the datagram; nothing hits the socket until submit()
+  void send(const void *data, size_t size, const struct sockaddr_in &addr);
+  void submit();
+
+  std::function<void(char *, size_t)> on_datagram;
+
+  void completecb();
+
+private:
+  struct impl;
+  std::unique_ptr<impl> d;
+};
+
+#endif // !_MESSAGING_URING_ENGINE_H
@@ -0,0 +1,171 @@
+#include "gtest/gtest.h"
+#include "messaging/id_source.h"
+#include "messaging/sequence.h"
+#include "messaging/fault_injector.h"
+#include "messaging/capture.h"
+
+#include <string>
+#include <cstdio>
+#include <unistd.h>
+#include <vector>
+
+class FileIdSourceTest : public testing::Test {
+public:
+  std::string path;
+
+  FileIdSourceTest() {
+    path = "/tmp/minimatch_seq_id_test." + std::to_string(getpid());
+    unlink(path.c_str());
+  }
+
+  ~FileIdSourceTest() {
+    unlink(path.c_str());
+  }
+};
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+TEST_F(FileIdSourceTest, FirstIdIsOne) {
+  file_id_source source(path.c_str());
+  ASSERT_EQ(source.allocate(1), 1);
+}
+
+TEST_F(FileIdSourceTest, RangesDontOverlap) {
+  file_id_source first(path.c_str());
+  file_id_source second(path.c_str());
+
+  ASSERT_EQ(first.allocate(1), 1);
+  ASSERT_EQ(second.allocate(4), 2);
+  ASSERT_EQ(first.allocate(1), 6);
+}
+
+TEST(SequenceNumbersTest, DetectsGapsAndDuplicates) {
+  sequence_numbers sequences(7);
+  ASSERT_EQ(sequences.local_id(), 7);
+
+  ASSERT_EQ(sequences.check(3, 1), 1);
+  sequences.commit(3, 1);
+
+  ASSERT_EQ(sequences.check(3, 1), 0);
+  ASSERT_EQ(sequences.check(3, 2), 1);
+  ASSERT_EQ(sequences.check(3, 5), 4);
+}
+
+TEST(SequenceNumbersTest, AllocatesConsecutively) {
+  sequence_numbers sequences(7);
+
+  ASSERT_EQ(sequences.alloc(), 1);
+  ASSERT_EQ(sequences.alloc(), 2);
+  sequences.commit(2);
+  ASSERT_EQ(sequences.alloc(), 3);
+}
+
+class FaultInjectorTest : public testing::Test {
+public:
+  std::vector<std::string> delivered;
+
+  fault_injector::deliver_fn collect() {
+    return [this](char *data, size_t size) {
+      delivered.emplace_back(data, size);
+    };
+  }
+
+  void inject_all(fault_injector &faults, int count) {
+    for (int i = 0; i < count; ++i) {
+      std::string datagram = std::to_string(i);
+      faults.inject(datagram.data(), datagram.size());
+    }
+  }
+};
+
+TEST_F(FaultInjectorTest, DisabledByDefault) {
+  fault_config_t config;
+  ASSERT_FALSE(config.enabled());
+}
+
+TEST_F(FaultInjectorTest, DropsEverything) {
+  fault_config_t config;
+  config.drop_rate = 1.0;
+
+  fault_injector faults(config, collect());
+  inject_all(faults, 10);
+
+  ASSERT_TRUE(delivered.empty());
+  ASSERT_EQ(faults.dropped(), 10u);
+}
+
+TEST_F(FaultInjectorTest, DuplicatesEverything) {
+  fault_config_t config;
+  config.duplicate_rate = 1.0;
+
+  fault_injector faults(config, collect());
+  inject_all(faults, 3);
+
+  ASSERT_EQ(delivered, std::vector<std::string>({"0", "0", "1", "1", "2", "2"}));
+}
+
+TEST_F(FaultInjectorTest, HoldsUntilDue) {
+  fault_config_t config;
+  config.delay = std::chrono::seconds(60);
+
+  fault_injector faults(config, collect());
+  inject_all(faults, 3);
+  ASSERT_TRUE(delivered.empty());
+
+  faults.release(fault_injector::clock::now() + std::chrono::seconds(61));
+  ASSERT_EQ(delivered, std::vector<std::string>({"0", "1", "2"}));
+}
+
+TEST_F(FaultInjectorTest, SameSeedSameLosses) {
+  fault_config_t config;
+  config.drop_rate = 0.5;
+  config.seed = 42;
+
+  fault_injector first(config, collect());
+  inject_all(first, 100);
+  std::vector<std::string> first_delivered;
+  first_delivered.swap(delivered);
+
+  fault_injector second(config, collect());
+  inject_all(second, 100);
+
+  ASSERT_EQ(first_delivered, delivered);
+  ASSERT_GT(first.dropped(), 0u);
+  ASSERT_LT(first.dropped(), 100u);
+}
+
+TEST(CaptureTest, ReplaysWhatWasCaptured) {
+  std::string path = "/tmp/minimatch_capture_test." + std::to_string(getpid());
+
+  struct sockaddr_in group;
+  group.sin_addr.s_addr = htonl(0xef000001);
+  group.sin_port = htons(40100);
+
+  {
+    auto writer = capture_writer::open(path);
+    ASSERT_EQ(writer, capture_writer::open(path));
+
+    writer->append(group, "first", 5);
+    writer->append(group, "second", 6);
+  }
+
+  std::vector<std::string> replayed;
+  uint64_t last_ns = 0;
+
+  uint64_t count = replay_capture(path, 0.0, [&](const capture_record_t &record, char *data, size_t size) {
+    ASSERT_EQ(record.group, group.sin_addr.s_addr);
+    ASSERT_EQ(record.port, group.sin_port);
+    ASSERT_GE(record.timestamp_ns, last_ns);
+
+    last_ns = record.timestamp_ns;
+    replayed.emplace_back(data, size);
+  });
+
+  unlink(path.c_str());
+
+  ASSERT_EQ(count, 2u);
+  ASSERT_EQ(replayed, std::vector<std::string>({"first", "second"}));
+}
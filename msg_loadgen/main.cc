@@ -3,7 +3,9 @@
 #include "api/apidef_generated.h"
 #include "framework/services.h"
 #include "messaging/messaging_service.h"
+#include "messaging/shm_service.h"
 #include "utils/timing.h"
+#include "utils/variables.h"
 
 #include <cstring>
 #include <cstdlib>
@@ -17,7 +19,12 @@ int main(int argc, const char **argv) {
   google::InitGoogleLogging(argv[0]);
   FLAGS_logtostderr = 1;
 
-  messaging_init();
+  if (read_variable<bool>("MSG_SHM", false)) {
+    shm_messaging_init();
+  }
+  else {
+    messaging_init();
+  }
 
   messaging_t *messaging = reinterpret_cast<messaging_t *>(find_service("messaging"));
 
@@ -41,7 +48,8 @@ int main(int argc, const char **argv) {
     auto root = api::CreateMessage(builder, api::MessageType_LimitOrder, order.Union());
     builder.Finish(root);
 
-    messaging->send_message(builder.GetBufferPointer(), builder.GetSize());
+    // Closed loop: spin until the transport has room again
+    while (messaging->send_message(builder.GetBufferPointer(), builder.GetSize()) == ERR_TXFULL);
     measure.collect(builder.GetSize());
   }
 
@@ -0,0 +1,134 @@
+#include <glog/logging.h>
+
+#include "messaging/capture.h"
+#include "messaging/multicast_connection.h"
+#include "utils/memory.h"
+#include "utils/timing.h"
+#include "utils/variables.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+/*
+ * Plays back a capture made with MSG_CAPTURE_FILE.
+ *
+ *   MSG_REPLAY_MODE=multicast  re-send the datagrams to their groups (or to
+ *                              MSG_REPLAY_GROUP/MSG_REPLAY_PORT)
+ *   MSG_REPLAY_MODE=deliver    run them through a multicast_connection's
+ *                              receive path in-process, to benchmark on_read
+ *   MSG_REPLAY_SPEED           1 keeps the original pacing, N is N times as
+ *                              fast, 0 is flat out
+ *
+ * Datagrams go out unmodified, seq ids included, so receivers that already
+ * saw the original stream will drop the replay as duplicates.
+ */
+
+// --
+static int open_sender() {
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    LOG(ERROR) << "Failed to create socket: " << strerror(errno);
+    std::abort();
+  }
+
+  unsigned char loop = 1, ttl = read_variable<int>("MSG_REPLAY_TTL", 1);
+  if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+      setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+    LOG(ERROR) << "Failed to set multicast options: " << strerror(errno);
+    std::abort();
+  }
+
+  return sock;
+}
+
+int main(int argc, const char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  if (argc != 2) {
+    LOG(ERROR) << "Usage: " << argv[0] << " <capture file>";
+    return EXIT_FAILURE;
+  }
+
+  std::string mode = read_variable<std::string>("MSG_REPLAY_MODE", "multicast");
+  double speed = read_variable<double>("MSG_REPLAY_SPEED", 1.0);
+
+  std::string group_override = read_variable<std::string>("MSG_REPLAY_GROUP", "");
+  uint16_t port_override = read_variable<uint16_t>("MSG_REPLAY_PORT", 0);
+
+  stream_measure measure("msg_replay");
+  uint64_t messages = 0;
+  replay_fn fn;
+
+  int sock = -1;
+  std::map<uint64_t, std::unique_ptr<multicast_connection>> connections;
+
+  if (mode == "multicast") {
+    sock = open_sender();
+
+    fn = [&](const capture_record_t &record, char *data, size_t size) {
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = group_override.empty() ? record.group : inet_addr(group_override.c_str());
+      addr.sin_port = port_override == 0 ? record.port : htons(port_override);
+
+      while (sendto(sock, data, size, 0, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        if (errno != EAGAIN && errno != ENOBUFS) {
+          LOG(ERROR) << "Failed to send: " << strerror(errno);
+          std::abort();
+        }
+      }
+
+      measure.collect(size);
+    };
+  }
+  else if (mode == "deliver") {
+    fn = [&](const capture_record_t &record, char *data, size_t size) {
+      uint64_t key = (static_cast<uint64_t>(record.group) << 16) | record.port;
+      auto &connection = connections[key];
+
+      if (!connection) {
+        struct in_addr group;
+        group.s_addr = record.group;
+
+        // Never joined, only its receive path is used
+        connection = make_unique<multicast_connection>(inet_ntoa(group), ntohs(record.port));
+        connection->on_read = [&](const void *, size_t size) {
+          messages++;
+          measure.collect(size);
+        };
+      }
+
+      connection->inject(data, size);
+    };
+  }
+  else {
+    LOG(ERROR) << "Unknown replay mode '" << mode << "'";
+    return EXIT_FAILURE;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t datagrams = replay_capture(argv[1], speed, fn);
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+  LOG(INFO) << "Replayed " << datagrams << " datagrams in " << elapsed.count() << "us";
+
+  if (mode == "deliver") {
+    LOG(INFO) << "Delivered " << messages << " messages to on_read";
+  }
+
+  if (sock >= 0) {
+    close(sock);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+// -*- c++ -*-
+
+#ifndef _UTILS_RCU_LIST_H
+#define _UTILS_RCU_LIST_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Copy-on-write list for data that is read all the time and changed rarely.
+ * Readers iterate an immutable contiguous snapshot without taking any lock;
+ * writers publish a new snapshot and free the old one once every reader that
+ * could have seen it is done (two reader counters, flipped per update).
+ *
+ * Don't modify the list from inside for_each, the writer would wait on itself.
+ */
+template<typename T>
+class rcu_list {
+public:
+  rcu_list()
+    : current(new std::vector<T>())
+    , epoch(0)
+  {
+    readers[0] = 0;
+    readers[1] = 0;
+  }
+
+  ~rcu_list() {
+    delete current.load();
+  }
+
+  // --
+  template<typename Fn>
+  void for_each(Fn &&fn) const {
+    int idx = epoch.load() & 1;
+    readers[idx].fetch_add(1);
+
+    const std::vector<T> *snapshot = current.load();
+    for (auto &value : *snapshot) {
+      fn(value);
+    }
+
+    readers[idx].fetch_sub(1);
+  }
+
+  // --
+  bool insert(const T &value) {
+    std::lock_guard<std::mutex> lock(writer_m);
+    const std::vector<T> *snapshot = current.load();
+
+    if (std::find(begin(*snapshot), end(*snapshot), value) != end(*snapshot)) {
+      return false;
+    }
+
+    std::vector<T> *updated = new std::vector<T>(*snapshot);
+    updated->push_back(value);
+    publish(updated);
+    return true;
+  }
+
+  // --
+  bool erase(const T &value) {
+    std::lock_guard<std::mutex> lock(writer_m);
+    const std::vector<T> *snapshot = current.load();
+
+    std::vector<T> *updated = new std::vector<T>(*snapshot);
+    auto iter = std::remove(begin(*updated), end(*updated), value);
+
+    if (iter == end(*updated)) {
+      delete updated;
+      return false;
+    }
+
+    updated->erase(iter, end(*updated));
+    publish(updated);
+    return true;
+  }
+
+  // --
+  void clear() {
+    std::lock_guard<std::mutex> lock(writer_m);
+    publish(new std::vector<T>());
+  }
+
+private:
+  // Caller holds writer_m
+  void publish(std::vector<T> *updated) {
+    std::vector<T> *retired = current.exchange(updated);
+
+    // Readers that entered before the flip may still hold the retired
+    // snapshot; readers after it are guaranteed to see the new one.
+    int idx = epoch.fetch_add(1) & 1;
+    while (readers[idx].load() != 0) {
+      std::this_thread::yield();
+    }
+
+    delete retired;
+  }
+
+  std::atomic<std::vector<T> *> current;
+  std::atomic<uint64_t> epoch;
+  mutable std::atomic<uint64_t> readers[2];
+  std::mutex writer_m;
+};
+
+#endif // !_UTILS_RCU_LIST_H
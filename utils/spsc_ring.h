@@ -0,0 +1,107 @@
+// -*- c++ -*-
+
+#ifndef _UTILS_SPSC_RING_H
+#define _UTILS_SPSC_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ * Single-producer/single-consumer ring of variable sized messages.
+ * Messages are stored inline as [size][data], 8 byte aligned; a record that
+ * doesn't fit before the end of the buffer is preceded by a wrap marker.
+ * Capacity must be a power of two.
+ */
+class spsc_ring {
+public:
+  explicit spsc_ring(size_t capacity)
+    : buffer(capacity)
+    , mask(capacity - 1)
+    , head(0)
+    , tail(0)
+  {
+  }
+
+  // Producer only. Returns false if there isn't room right now.
+  bool push(const void *data, size_t size) {
+    size_t record = record_size(size);
+    if (record > buffer.size()) {
+      return false;
+    }
+
+    uint64_t h = head.load(std::memory_order_relaxed);
+    uint64_t t = tail.load(std::memory_order_acquire);
+    size_t offset = h & mask;
+    size_t contiguous = buffer.size() - offset;
+    size_t needed = record + (contiguous < record ? contiguous : 0);
+
+    if (h + needed - t > buffer.size()) {
+      return false;
+    }
+
+    if (contiguous < record) {
+      write_size(offset, WRAP_MARKER);
+      h += contiguous;
+      offset = 0;
+    }
+
+    write_size(offset, size);
+    memcpy(&buffer[offset + sizeof(uint32_t)], data, size);
+    head.store(h + record, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Calls fn(data, size) for the oldest message, if any.
+  template<typename Fn>
+  bool pop(Fn &&fn) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    size_t offset = t & mask;
+    uint32_t size = read_size(offset);
+
+    if (size == WRAP_MARKER) {
+      t += buffer.size() - offset;
+      offset = 0;
+      size = read_size(offset);
+    }
+
+    fn(&buffer[offset + sizeof(uint32_t)], size);
+    tail.store(t + record_size(size), std::memory_order_release);
+    return true;
+  }
+
+  // Bytes in use, approximate when called from a third thread
+  size_t depth() const {
+    return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+  }
+
+private:
+  static const uint32_t WRAP_MARKER = 0xffffffff;
+
+  static size_t record_size(size_t size) {
+    return (sizeof(uint32_t) + size + 7) & ~size_t(7);
+  }
+
+  void write_size(size_t offset, uint32_t size) {
+    memcpy(&buffer[offset], &size, sizeof(size));
+  }
+
+  uint32_t read_size(size_t offset) const {
+    uint32_t size;
+    memcpy(&size, &buffer[offset], sizeof(size));
+    return size;
+  }
+
+  std::vector<char> buffer;
+  const size_t mask;
+
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+};
+
+#endif // !_UTILS_SPSC_RING_H
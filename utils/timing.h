@@ -9,6 +9,7 @@
 #include <glog/logging.h>
 #include <cstdint>
 #include <limits>
+#include <algorithm>
 
 /*
  * Measures the run-time of some code and averages.
@@ -118,4 +119,80 @@ private:
   const char *name;
 };
 
+/*
+ * Power-of-two bucketed distribution, reported in discrete periods.
+ * Percentiles are upper bounds of the bucket they fall in.
+ */
+class distribution {
+public:
+  distribution(const char *name)
+    : name(name)
+  {
+    period_start = std::chrono::high_resolution_clock::now();
+    reset();
+  }
+
+  // --
+  void collect(uint64_t value) {
+    auto t = std::chrono::high_resolution_clock::now();
+    int diff = std::chrono::duration_cast<std::chrono::milliseconds>(t - period_start).count();
+
+    if (diff >= 1000) {
+      report();
+      period_start = t;
+      reset();
+    }
+
+    buckets[bucket_of(value)]++;
+    count++;
+    sum += value;
+    max_value = std::max(max_value, value);
+  }
+
+private:
+  static const int BUCKET_COUNT = 65;
+
+  static int bucket_of(uint64_t value) {
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+  }
+
+  uint64_t percentile(double p) const {
+    uint64_t threshold = count * p;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+      seen += buckets[i];
+      if (seen > threshold) {
+        return i == 0 ? 0 : std::min(max_value, (uint64_t(1) << (i - 1)) * 2 - 1);
+      }
+    }
+
+    return max_value;
+  }
+
+  void reset() {
+    std::fill(buckets, buckets + BUCKET_COUNT, 0);
+    count = 0;
+    sum = 0;
+    max_value = 0;
+  }
+
+  void report() {
+    if (count == 0) {
+      return;
+    }
+
+    LOG(INFO) << name << ": count=" << count
+              << " avg=" << sum / count
+              << " p50=" << percentile(0.5)
+              << " p99=" << percentile(0.99)
+              << " max=" << max_value;
+  }
+
+  std::chrono::high_resolution_clock::time_point period_start;
+  uint64_t buckets[BUCKET_COUNT];
+  uint64_t count, sum, max_value;
+  const char *name;
+};
+
 #endif // !_UTILS_TIMING_H
@@ -0,0 +1,67 @@
+// -*- c++ -*-
+
+#ifndef _UTILS_TOKEN_BUCKET_H
+#define _UTILS_TOKEN_BUCKET_H
+
+#include <algorithm>
+#include <chrono>
+
+/*
+ * Classic token bucket: refills at rate tokens per second up to burst.
+ * Refill is computed lazily on use, so every call is O(1). Not thread safe.
+ */
+class token_bucket {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  token_bucket(double rate, double burst)
+    : rate(rate)
+    , burst(std::max(burst, 1.0))
+    , tokens(this->burst)
+    , last(clock::now())
+  {
+  }
+
+  // Takes one token if there is one
+  bool take(clock::time_point now) {
+    refill(now);
+
+    if (tokens < 1.0) {
+      return false;
+    }
+
+    tokens -= 1.0;
+    return true;
+  }
+
+  // Undoes a take, when a second bucket said no
+  void give_back() {
+    tokens = std::min(tokens + 1.0, burst);
+  }
+
+  // How long until take succeeds
+  clock::duration wait_time(clock::time_point now) {
+    refill(now);
+
+    if (tokens >= 1.0) {
+      return clock::duration::zero();
+    }
+
+    return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((1.0 - tokens) / rate));
+  }
+
+private:
+  void refill(clock::time_point now) {
+    if (now > last) {
+      tokens = std::min(burst, tokens + std::chrono::duration<double>(now - last).count() * rate);
+      last = now;
+    }
+  }
+
+  const double rate;
+  const double burst;
+  double tokens;
+  clock::time_point last;
+};
+
+#endif // !_UTILS_TOKEN_BUCKET_H
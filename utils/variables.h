@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <cstring>
 #include <sstream>
+#include <vector>
 
 // --
 template<typename T>
@@ -49,4 +50,19 @@ inline T read_variable(const char *name, const T &default_value = T()) {
   }
 }
 
+// --
+inline std::vector<std::string> split(const std::string &value, char delim) {
+  std::vector<std::string> parts;
+  std::stringstream ss(value);
+  std::string part;
+
+  while (std::getline(ss, part, delim)) {
+    if (!part.empty()) {
+      parts.push_back(part);
+    }
+  }
+
+  return parts;
+}
+
 #endif // !_UTILS_VARIABLES_H